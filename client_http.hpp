@@ -2,12 +2,27 @@
 #define CLIENT_HTTP_HPP
 
 #include "utility.hpp"
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <future>
 #include <limits>
 #include <mutex>
 #include <random>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
 #ifdef USE_STANDALONE_ASIO
 #include <asio.hpp>
 #include <asio/steady_timer.hpp>
@@ -29,20 +44,9 @@ namespace SimpleWeb {
 } // namespace SimpleWeb
 #endif
 
-#if __cplusplus > 201402L || (defined(_MSC_VER) && _MSC_VER >= 1910)
-#include <string_view>
-namespace SimpleWeb {
-  using string_view = std::string_view;
-}
-#elif !defined(USE_STANDALONE_ASIO)
-#include <boost/utility/string_ref.hpp>
-namespace SimpleWeb {
-  using string_view = boost::string_ref;
-}
-#else
-namespace SimpleWeb {
-  using string_view = const std::string &;
-}
+// sendfile() waits for the socket with basic_socket::async_wait(), added in Boost 1.66 and Asio 1.12
+#if defined(__linux__) && ((defined(USE_STANDALONE_ASIO) && ASIO_VERSION >= 101200) || (!defined(USE_STANDALONE_ASIO) && BOOST_ASIO_VERSION >= 101200))
+#define SIMPLE_WEB_SENDFILE
 #endif
 
 namespace SimpleWeb {
@@ -84,6 +88,9 @@ namespace SimpleWeb {
 
       asio::streambuf streambuf;
 
+      /// Set for streamed responses, see ClientBase::request_stream()
+      std::function<void(std::function<void(const error_code &, bool)> &&)> content_reader;
+
       Response(std::size_t max_response_streambuf_size) noexcept : streambuf(max_response_streambuf_size), content(streambuf) {}
 
     public:
@@ -92,6 +99,16 @@ namespace SimpleWeb {
       Content content;
 
       CaseInsensitiveMultimap header;
+
+      /// Reads the next part of the content of a streamed response, see ClientBase::request_stream(), and appends it to content.
+      /// callback is called when the part has been read, with end set to true when the whole content has been read.
+      /// Consume content between the parts to keep memory usage constant.
+      void read_content(std::function<void(const error_code &ec, bool end)> &&callback) {
+        if(content_reader)
+          content_reader(std::move(callback));
+        else
+          callback(error_code(), true);
+      }
     };
 
     class Config {
@@ -110,24 +127,169 @@ namespace SimpleWeb {
       std::size_t max_response_streambuf_size = std::numeric_limits<std::size_t>::max();
       /// Set proxy server (server:port)
       std::string proxy_server;
+      /// Maximum number of connections, in use or idle. Requests are queued while the limit is reached.
+      /// Default value: 0 (no limit).
+      std::size_t max_connections = 0;
+      /// Maximum number of requests in flight. Further requests are queued. Default value: 0 (no limit).
+      std::size_t max_requests_in_flight = 0;
+      /// Maximum number of idle connections kept open for HTTP persistent connection. Default value: 1.
+      std::size_t max_idle_connections = 1;
+      /// Number of idle connections that are not closed by timeout_idle. Default value: 1.
+      std::size_t min_idle_connections = 1;
+      /// Close connections that have been idle for the given number of seconds. Idle connections are
+      /// checked when a connection is acquired or released. Default value: 0 (no timeout).
+      long timeout_idle = 0;
+      /// Number of seconds resolved addresses are cached. Expired addresses are still used while
+      /// they are resolved again in the background. Default value: 60. Set to 0 to disable caching.
+      long resolve_cache_ttl = 60;
+      /// Milliseconds to wait for a connection attempt before also trying the next resolved address,
+      /// see RFC 8305 (Happy Eyeballs). Default value: 250.
+      long connection_attempt_delay = 250;
+      /// Maximum number of requests sent on a connection before their responses are received (HTTP pipelining).
+      /// Only idempotent requests (GET, HEAD, PUT, DELETE, OPTIONS and TRACE) are pipelined, and a request is
+      /// pipelined on an active connection before a new connection is opened. Default value: 1 (no pipelining).
+      std::size_t max_pipelined_requests = 1;
+      /// Maximum number of bytes read for each part of a streamed response content, see ClientBase::request_stream().
+      /// Default value: 65536.
+      std::size_t max_content_part_size = 65536;
+      /// Maximum number of TLS sessions kept by Client<HTTPS> to resume on new connections, which avoids full handshakes.
+      /// Default value: 8. Set to 0 to disable session resumption, which is always disabled before OpenSSL 1.1.1.
+      std::size_t max_tls_sessions = 8;
+#ifdef HAVE_ZLIB
+      /// Set to true to send Accept-Encoding: gzip, deflate, and to decompress gzip and deflate encoded responses.
+      /// The Content-Encoding and Content-Length header fields are removed from decompressed responses.
+      bool accept_encoding = false;
+#endif
+    };
+
+    /// Called by request_chunked() when the next part of the content can be sent. Call send once with the next part, either
+    /// directly or later from a handler of the io_service, and with an empty part when the content is complete.
+    using ContentProducer = std::function<void(std::function<void(string_view part)> send)>;
+
+    /// A request of request_batch()
+    class BatchRequest {
+    public:
+      BatchRequest(std::string method, std::string path = std::string("/"), std::string content = std::string(),
+                   CaseInsensitiveMultimap header = CaseInsensitiveMultimap()) noexcept
+          : method(std::move(method)), path(std::move(path)), content(std::move(content)), header(std::move(header)) {}
+
+      std::string method, path, content;
+      CaseInsensitiveMultimap header;
+    };
+
+    /// The outcome of a request of request_batch(). Requests that were not completed have error operation_canceled.
+    class BatchResult {
+    public:
+      std::shared_ptr<Response> response;
+      error_code ec = make_error_code::make_error_code(errc::operation_canceled);
+    };
+
+    /// Resolve and connect statistics for the server, or the proxy server if set
+    class ConnectStatistics {
+    public:
+      /// Number of completed address lookups
+      std::size_t resolves = 0;
+      /// Number of address lookups served from the cache
+      std::size_t resolve_cache_hits = 0;
+      std::chrono::steady_clock::duration last_resolve_time = std::chrono::steady_clock::duration::zero();
+      std::chrono::steady_clock::duration total_resolve_time = std::chrono::steady_clock::duration::zero();
+      /// Number of established connections
+      std::size_t connects = 0;
+      std::chrono::steady_clock::duration last_connect_time = std::chrono::steady_clock::duration::zero();
+      std::chrono::steady_clock::duration total_connect_time = std::chrono::steady_clock::duration::zero();
     };
 
   protected:
+    /// Concurrent connection attempts to resolved addresses, see ClientBase::connect_endpoints()
+    class ConnectAttempts {
+    public:
+      ConnectAttempts(std::shared_ptr<const std::vector<asio::ip::tcp::endpoint>> endpoints, std::function<void(const error_code &)> &&callback) noexcept
+          : endpoints(std::move(endpoints)), callback(std::move(callback)), start_time(std::chrono::steady_clock::now()) {}
+
+      std::shared_ptr<const std::vector<asio::ip::tcp::endpoint>> endpoints;
+      std::function<void(const error_code &)> callback;
+      std::chrono::steady_clock::time_point start_time;
+
+      std::mutex mutex;
+      /// One socket per started attempt, in the order of endpoints
+      std::vector<std::unique_ptr<asio::ip::tcp::socket>> sockets;
+      std::size_t pending = 0;
+      bool done = false;
+      bool canceled = false;
+      std::unique_ptr<asio::steady_timer> delay_timer;
+      std::unique_ptr<asio::steady_timer> timeout_timer;
+
+      /// Aborts all connection attempts. mutex must be locked.
+      void cancel_attempts() noexcept {
+        canceled = true;
+        error_code ec;
+        for(auto &socket : sockets) {
+          if(socket)
+            socket->close(ec);
+        }
+        if(delay_timer)
+          delay_timer->cancel(ec);
+        if(timeout_timer)
+          timeout_timer->cancel(ec);
+      }
+
+      void cancel() noexcept {
+        std::unique_lock<std::mutex> lock(mutex);
+        cancel_attempts();
+      }
+    };
+
+    class Session;
+
     class Connection : public std::enable_shared_from_this<Connection> {
     public:
       template <typename... Args>
-      Connection(std::shared_ptr<ScopeRunner> handler_runner, long timeout, Args &&... args) noexcept
-          : handler_runner(std::move(handler_runner)), timeout(timeout), socket(new socket_type(std::forward<Args>(args)...)) {}
+      Connection(std::shared_ptr<ScopeRunner> handler_runner, long timeout, std::size_t max_response_streambuf_size, Args &&... args) noexcept
+          : handler_runner(std::move(handler_runner)), timeout(timeout), socket(new socket_type(std::forward<Args>(args)...)), read_buffer(max_response_streambuf_size) {}
 
       std::shared_ptr<ScopeRunner> handler_runner;
       long timeout;
 
       std::unique_ptr<socket_type> socket; // Socket must be unique_ptr since asio::ssl::stream<asio::ip::tcp::socket> is not movable
+      /// Received data not yet parsed, which might include the start of the next pipelined response
+      asio::streambuf read_buffer;
+
+      // The following members are protected by ClientBase::connections_mutex
       bool in_use = false;
-      bool attempt_reconnect = true;
+      std::chrono::steady_clock::time_point idle_time;
+      /// Set while connecting
+      std::weak_ptr<ConnectAttempts> connect_attempts;
+      /// Sessions assigned to this connection, in the order their responses are received
+      std::deque<std::shared_ptr<Session>> pipeline;
+      /// Number of sessions at the front of pipeline whose requests have been written
+      std::size_t pipeline_written = 0;
+      bool connected = false;
+      bool writing = false;
+      bool reading = false;
+      /// Set to false when a response shows that the server closes the connection
+      bool keep_alive = true;
+      /// Set when the connection has been closed on error, and its sessions have been retried or failed
+      bool failed = false;
 
       std::unique_ptr<asio::steady_timer> timer;
 
+      /// Memory for the handlers of the asynchronous operations on this connection
+      HandlerMemory handler_memory;
+
+      /// Returns true if the connection has been closed, for instance by the server while idle
+      bool is_stale() noexcept {
+        if(!socket->lowest_layer().is_open())
+          return true;
+        auto &tcp_socket = this->tcp_socket();
+        error_code ec;
+        tcp_socket.non_blocking(true, ec);
+        char chr;
+        tcp_socket.receive(asio::buffer(&chr, 1), asio::socket_base::message_peek, ec);
+        error_code ec_ignored;
+        tcp_socket.non_blocking(false, ec_ignored);
+        return ec && ec != asio::error::would_block;
+      }
+
       void set_timeout(long seconds = 0) noexcept {
         if(seconds == 0)
           seconds = timeout;
@@ -135,15 +297,17 @@ namespace SimpleWeb {
           timer = nullptr;
           return;
         }
-        timer = std::unique_ptr<asio::steady_timer>(new asio::steady_timer(socket->get_io_service()));
+        // Reuse the timer of the previous timeout, if any, where expires_from_now() cancels the previous wait
+        if(!timer)
+          timer = std::unique_ptr<asio::steady_timer>(new asio::steady_timer(socket->get_io_service()));
         timer->expires_from_now(std::chrono::seconds(seconds));
         auto self = this->shared_from_this();
-        timer->async_wait([self](const error_code &ec) {
+        timer->async_wait(make_memory_handler(self, [self](const error_code &ec) {
           if(!ec) {
             error_code ec;
             self->socket->lowest_layer().cancel(ec);
           }
-        });
+        }));
       }
 
       void cancel_timeout() noexcept {
@@ -152,6 +316,130 @@ namespace SimpleWeb {
           timer->cancel(ec);
         }
       }
+
+      /// Returns the underlying TCP socket
+      asio::ip::tcp::socket &tcp_socket() noexcept {
+        return tcp_socket(*socket);
+      }
+
+    private:
+      static asio::ip::tcp::socket &tcp_socket(asio::ip::tcp::socket &socket) noexcept {
+        return socket;
+      }
+      template <class stream_type>
+      static asio::ip::tcp::socket &tcp_socket(stream_type &stream) noexcept {
+        return stream.next_layer();
+      }
+    };
+
+#ifdef HAVE_ZLIB
+    /// Decompresses gzip or deflate encoded content while it is received.
+    /// The inflate states are kept per thread, and reused by later responses.
+    class ContentDecoder {
+      class InflateState {
+      public:
+        InflateState() noexcept {
+          std::memset(&stream, 0, sizeof(stream));
+          initialized = inflateInit2(&stream, 15 + 32) == Z_OK;
+        }
+        ~InflateState() noexcept {
+          if(initialized)
+            inflateEnd(&stream);
+        }
+
+        z_stream stream;
+        bool initialized;
+      };
+
+      static std::vector<std::unique_ptr<InflateState>> &cached_states() noexcept {
+        thread_local std::vector<std::unique_ptr<InflateState>> states;
+        return states;
+      }
+
+      std::unique_ptr<InflateState> state;
+      bool gzip;
+      bool stream_end = false;
+
+    public:
+      ContentDecoder(bool gzip) noexcept : gzip(gzip) {}
+      ~ContentDecoder() noexcept {
+        if(state) {
+          auto &states = cached_states();
+          if(states.size() < 16)
+            states.emplace_back(std::move(state));
+        }
+      }
+
+      /// Returns true when the end of the compressed stream has been decompressed
+      bool finished() const noexcept {
+        return stream_end;
+      }
+
+      /// Compressed content that has not yet been decompressed
+      asio::streambuf input;
+
+      /// Decompresses input to output, and returns an error if the content is invalid or output is full
+      error_code decode(asio::streambuf &output) noexcept {
+        if(!state) {
+          if(!gzip && input.size() < 2 && !stream_end)
+            return error_code();
+          auto &states = cached_states();
+          if(!states.empty()) {
+            state = std::move(states.back());
+            states.pop_back();
+          }
+          else
+            state = std::unique_ptr<InflateState>(new InflateState());
+          int window_bits = 15 + 16; // gzip
+          if(!gzip) { // Some servers send raw deflate data instead of the zlib format
+            auto data = asio::buffer_cast<const unsigned char *>(input.data());
+            window_bits = (data[0] & 0x0f) == 8 && ((data[0] << 8) | data[1]) % 31 == 0 ? 15 : -15;
+          }
+          if(!state->initialized || inflateReset2(&state->stream, window_bits) != Z_OK) {
+            state = nullptr;
+            return make_error_code::make_error_code(errc::not_enough_memory);
+          }
+        }
+        while(input.size() > 0 && !stream_end) {
+          if(output.size() == output.max_size())
+            return make_error_code::make_error_code(errc::message_size);
+          auto in_size = input.size();
+          auto out_size = std::min<std::size_t>(std::max<std::size_t>(in_size * 4, 4096), output.max_size() - output.size());
+          auto out = output.prepare(out_size);
+          auto &stream = state->stream;
+          stream.next_in = const_cast<Bytef *>(asio::buffer_cast<const Bytef *>(input.data()));
+          stream.avail_in = static_cast<uInt>(in_size);
+          stream.next_out = asio::buffer_cast<Bytef *>(out);
+          stream.avail_out = static_cast<uInt>(out_size);
+          auto result = inflate(&stream, Z_NO_FLUSH);
+          input.consume(in_size - stream.avail_in);
+          output.commit(out_size - stream.avail_out);
+          if(result == Z_STREAM_END) {
+            stream_end = true;
+            input.consume(input.size()); // Ignore data after the compressed stream
+          }
+          else if(result != Z_OK && result != Z_BUF_ERROR)
+            return make_error_code::make_error_code(errc::illegal_byte_sequence);
+        }
+        return error_code();
+      }
+    };
+#endif
+
+    /// Request content that is sent from a file, see request_file()
+    class ContentFile {
+    public:
+      ContentFile(std::string path_) noexcept : path(std::move(path_)), stream(path, std::ios::binary) {
+        if(stream) {
+          stream.seekg(0, std::ios::end);
+          size = static_cast<std::size_t>(stream.tellg());
+          stream.seekg(0, std::ios::beg);
+        }
+      }
+
+      std::string path;
+      std::ifstream stream;
+      std::size_t size = 0;
     };
 
     class Session {
@@ -163,6 +451,48 @@ namespace SimpleWeb {
       std::unique_ptr<asio::streambuf> request_streambuf;
       std::shared_ptr<Response> response;
       std::function<void(const std::shared_ptr<Connection> &, const error_code &)> callback;
+
+      /// Idempotent requests can be pipelined, and are retried once on a new connection if the connection is lost
+      bool idempotent = false;
+      /// Responses to HEAD requests have no content
+      bool head = false;
+      bool retried = false;
+      /// True if the session was assigned to a connection that already had sessions in its pipeline
+      bool pipelined = false;
+
+      /// Request content in memory owned by the caller, see request_buffers()
+      std::vector<asio::const_buffer> content_buffers;
+      /// Request content sent from a file after request_streambuf, see request_file()
+      std::shared_ptr<ContentFile> content_file;
+      /// Request content sent in chunks after request_streambuf, see request_chunked()
+      std::shared_ptr<ContentProducer> content_producer;
+
+#ifdef HAVE_ZLIB
+      /// Set when the response content is decompressed, see Config::accept_encoding
+      std::unique_ptr<ContentDecoder> decoder;
+#endif
+
+      /// Set for streamed responses, see ClientBase::request_stream()
+      std::function<void(std::shared_ptr<Response>, const error_code &)> header_callback;
+      /// Callback of the current Response::read_content() call
+      std::function<void(const error_code &, bool)> content_callback;
+      enum class ContentState { header, length, chunked, until_eof, complete };
+      ContentState content_state = ContentState::header;
+      /// Remaining bytes of the content with a Content-Length header field
+      unsigned long long content_remaining = 0;
+      /// Decoder of chunked transfer encoded content
+      std::unique_ptr<ChunkedDecoder> chunked_decoder;
+    };
+
+    /// Work that remains after a session has been released from its connection, see ClientBase::release_session()
+    class SessionRelease {
+    public:
+      /// Next session in the pipeline of the released connection, whose response should be read
+      std::shared_ptr<Session> read_session;
+      /// Queued sessions that have been assigned a connection
+      std::vector<std::shared_ptr<Session>> start_sessions;
+      /// Sessions of a lost connection that are not retried
+      std::vector<std::pair<std::shared_ptr<Session>, error_code>> failed_sessions;
     };
 
   public:
@@ -175,27 +505,25 @@ namespace SimpleWeb {
 
     /// Convenience function to perform synchronous request. The io_service is run within this function.
     /// If reusing the io_service for other tasks, use the asynchronous request functions instead.
-    /// Do not use concurrently with the asynchronous request functions.
+    /// Do not use concurrently with the asynchronous request functions, unless the io_service is run by start_io_threads().
     std::shared_ptr<Response> request(const std::string &method, const std::string &path = std::string("/"),
                                       string_view content = "", const CaseInsensitiveMultimap &header = CaseInsensitiveMultimap()) {
+      if(io_threads_running())
+        return request_async(method, path, content, header).get();
+
       std::shared_ptr<Response> response;
       error_code ec;
-      request(method, path, content, header, [&response, &ec](std::shared_ptr<Response> response_, const error_code &ec_) {
+      bool done = false;
+      std::unique_ptr<asio::io_service::work> work;
+      request(method, path, content, header, [this, &response, &ec, &done, &work](std::shared_ptr<Response> response_, const error_code &ec_) {
+        std::unique_lock<std::mutex> lock(this->concurrent_synchronous_requests_mutex);
         response = response_;
         ec = ec_;
+        done = true;
+        work = nullptr;
       });
 
-      {
-        std::unique_lock<std::mutex> lock(concurrent_synchronous_requests_mutex);
-        ++concurrent_synchronous_requests;
-      }
-      io_service->run();
-      {
-        std::unique_lock<std::mutex> lock(concurrent_synchronous_requests_mutex);
-        --concurrent_synchronous_requests;
-        if(!concurrent_synchronous_requests)
-          io_service->reset();
-      }
+      run_synchronous_request(done, work);
 
       if(ec)
         throw system_error(ec);
@@ -205,27 +533,25 @@ namespace SimpleWeb {
 
     /// Convenience function to perform synchronous request. The io_service is run within this function.
     /// If reusing the io_service for other tasks, use the asynchronous request functions instead.
-    /// Do not use concurrently with the asynchronous request functions.
+    /// Do not use concurrently with the asynchronous request functions, unless the io_service is run by start_io_threads().
     std::shared_ptr<Response> request(const std::string &method, const std::string &path, std::istream &content,
                                       const CaseInsensitiveMultimap &header = CaseInsensitiveMultimap()) {
+      if(io_threads_running())
+        return request_async(method, path, content, header).get();
+
       std::shared_ptr<Response> response;
       error_code ec;
-      request(method, path, content, header, [&response, &ec](std::shared_ptr<Response> response_, const error_code &ec_) {
+      bool done = false;
+      std::unique_ptr<asio::io_service::work> work;
+      request(method, path, content, header, [this, &response, &ec, &done, &work](std::shared_ptr<Response> response_, const error_code &ec_) {
+        std::unique_lock<std::mutex> lock(this->concurrent_synchronous_requests_mutex);
         response = response_;
         ec = ec_;
+        done = true;
+        work = nullptr;
       });
 
-      {
-        std::unique_lock<std::mutex> lock(concurrent_synchronous_requests_mutex);
-        ++concurrent_synchronous_requests;
-      }
-      io_service->run();
-      {
-        std::unique_lock<std::mutex> lock(concurrent_synchronous_requests_mutex);
-        --concurrent_synchronous_requests;
-        if(!concurrent_synchronous_requests)
-          io_service->reset();
-      }
+      run_synchronous_request(done, work);
 
       if(ec)
         throw system_error(ec);
@@ -236,49 +562,10 @@ namespace SimpleWeb {
     /// Asynchronous request where setting and/or running Client's io_service is required.
     /// Do not use concurrently with the synchronous request functions.
     void request(const std::string &method, const std::string &path, string_view content, const CaseInsensitiveMultimap &header,
-                 std::function<void(std::shared_ptr<Response>, const error_code &)> &&request_callback_) {
-      auto session = std::make_shared<Session>(config.max_response_streambuf_size, get_connection(), create_request_header(method, path, header));
-      auto response = session->response;
-      auto request_callback = std::make_shared<std::function<void(std::shared_ptr<Response>, const error_code &)>>(std::move(request_callback_));
-      session->callback = [this, response, request_callback](const std::shared_ptr<Connection> &connection, const error_code &ec) {
-        {
-          std::unique_lock<std::mutex> lock(this->connections_mutex);
-          connection->in_use = false;
-
-          // Remove unused connections, but keep one open for HTTP persistent connection:
-          std::size_t unused_connections = 0;
-          for(auto it = this->connections.begin(); it != this->connections.end();) {
-            if(ec && connection == *it)
-              it = this->connections.erase(it);
-            else if((*it)->in_use)
-              ++it;
-            else {
-              ++unused_connections;
-              if(unused_connections > 1)
-                it = this->connections.erase(it);
-              else
-                ++it;
-            }
-          }
-        }
-
-        if(*request_callback)
-          (*request_callback)(response, ec);
-      };
-
-      std::ostream write_stream(session->request_streambuf.get());
-      if(content.size() > 0) {
-        auto header_it = header.find("Content-Length");
-        if(header_it == header.end()) {
-          header_it = header.find("Transfer-Encoding");
-          if(header_it == header.end() || header_it->second != "chunked")
-            write_stream << "Content-Length: " << content.size() << "\r\n";
-        }
-      }
-      write_stream << "\r\n"
-                   << content;
-
-      connect(session);
+                 std::function<void(std::shared_ptr<Response>, const error_code &)> &&request_callback) {
+      auto session = create_session(method, path, header, std::move(request_callback));
+      write_request(session, content, header);
+      connect_when_available(session);
     }
 
     /// Asynchronous request where setting and/or running Client's io_service is required.
@@ -301,77 +588,236 @@ namespace SimpleWeb {
 
     /// Asynchronous request where setting and/or running Client's io_service is required.
     void request(const std::string &method, const std::string &path, std::istream &content, const CaseInsensitiveMultimap &header,
-                 std::function<void(std::shared_ptr<Response>, const error_code &)> &&request_callback_) {
-      auto session = std::make_shared<Session>(config.max_response_streambuf_size, get_connection(), create_request_header(method, path, header));
-      auto response = session->response;
-      auto request_callback = std::make_shared<std::function<void(std::shared_ptr<Response>, const error_code &)>>(std::move(request_callback_));
-      session->callback = [this, response, request_callback](const std::shared_ptr<Connection> &connection, const error_code &ec) {
-        {
-          std::unique_lock<std::mutex> lock(this->connections_mutex);
-          connection->in_use = false;
+                 std::function<void(std::shared_ptr<Response>, const error_code &)> &&request_callback) {
+      auto session = create_session(method, path, header, std::move(request_callback));
+      write_request(session, content, header);
+      connect_when_available(session);
+    }
 
-          // Remove unused connections, but keep one open for HTTP persistent connection:
-          std::size_t unused_connections = 0;
-          for(auto it = this->connections.begin(); it != this->connections.end();) {
-            if(ec && connection == *it)
-              it = this->connections.erase(it);
-            else if((*it)->in_use)
-              ++it;
-            else {
-              ++unused_connections;
-              if(unused_connections > 1)
-                it = this->connections.erase(it);
-              else
-                ++it;
-            }
-          }
-        }
+    /// Asynchronous request where setting and/or running Client's io_service is required.
+    void request(const std::string &method, const std::string &path, std::istream &content,
+                 std::function<void(std::shared_ptr<Response>, const error_code &)> &&request_callback) {
+      request(method, path, content, CaseInsensitiveMultimap(), std::move(request_callback));
+    }
 
-        if(*request_callback)
-          (*request_callback)(response, ec);
+    /// Asynchronous request where the response content is read in parts instead of being stored in the response.
+    /// header_callback is called when the status line and header fields have been received, or on error.
+    /// Then call response->read_content() to read each part of the content, until end is set or an error is given.
+    /// The connection is not used for other requests until the whole content has been read.
+    void request_stream(const std::string &method, const std::string &path, string_view content, const CaseInsensitiveMultimap &header,
+                        std::function<void(std::shared_ptr<Response>, const error_code &)> &&header_callback) {
+      auto session = create_session(method, path, header, nullptr);
+      session->header_callback = std::move(header_callback);
+      std::weak_ptr<Session> session_weak(session); // To avoid cyclic reference
+      session->response->content_reader = [this, session_weak](std::function<void(const error_code &, bool)> &&callback) {
+        if(auto session = session_weak.lock())
+          this->read_content(session, std::move(callback));
+        else
+          callback(make_error_code::make_error_code(errc::operation_canceled), false);
       };
+      write_request(session, content, header);
+      connect_when_available(session);
+    }
 
-      content.seekg(0, std::ios::end);
-      auto content_length = content.tellg();
-      content.seekg(0, std::ios::beg);
-      std::ostream write_stream(session->request_streambuf.get());
-      if(content_length > 0) {
-        auto header_it = header.find("Content-Length");
-        if(header_it == header.end()) {
-          header_it = header.find("Transfer-Encoding");
-          if(header_it == header.end() || header_it->second != "chunked")
-            write_stream << "Content-Length: " << content_length << "\r\n";
-        }
+    /// Asynchronous request where the response content is read in parts instead of being stored in the response.
+    void request_stream(const std::string &method, const std::string &path,
+                        std::function<void(std::shared_ptr<Response>, const error_code &)> &&header_callback) {
+      request_stream(method, path, std::string(), CaseInsensitiveMultimap(), std::move(header_callback));
+    }
+
+    /// Asynchronous requests where at most max_concurrency requests are in progress at a time, or all if max_concurrency is 0.
+    /// callback is called once with the results in the order of requests.
+    /// If required_successes is not 0, callback is called as soon as that many requests have succeeded, and the requests
+    /// that have not been started are not sent.
+    void request_batch(std::vector<BatchRequest> requests, std::size_t max_concurrency,
+                       std::function<void(std::vector<BatchResult> &&)> &&callback, std::size_t required_successes = 0) {
+      auto batch = std::make_shared<Batch>();
+      batch->requests = std::move(requests);
+      batch->results.resize(batch->requests.size());
+      batch->max_concurrency = max_concurrency > 0 ? max_concurrency : batch->requests.size();
+      batch->required_successes = required_successes;
+      batch->callback = std::move(callback);
+      if(batch->requests.empty() || (required_successes > 0 && required_successes > batch->requests.size())) {
+        batch->callback(std::move(batch->results));
+        return;
+      }
+      request_batch_next(batch);
+    }
+
+    /// Asynchronous request where the content is sent directly from the given buffers instead of being copied.
+    /// The memory referenced by content_buffers must remain valid until request_callback is called.
+    void request_buffers(const std::string &method, const std::string &path, std::vector<asio::const_buffer> content_buffers, const CaseInsensitiveMultimap &header,
+                         std::function<void(std::shared_ptr<Response>, const error_code &)> &&request_callback) {
+      auto session = create_session(method, path, header, std::move(request_callback));
+      std::size_t content_length = 0;
+      for(auto &buffer : content_buffers)
+        content_length += asio::buffer_size(buffer);
+      write_header_end(session, content_length, header);
+      session->content_buffers = std::move(content_buffers);
+      connect_when_available(session);
+    }
+
+    /// Asynchronous request where the content, of unknown size, is sent with chunked transfer coding.
+    /// content_producer is called for each part of the content after the previous part has been sent.
+    /// The request is never retried or pipelined, since the content cannot be sent again.
+    /// A Content-Length header field, or a Transfer-Encoding header field whose final coding is not chunked,
+    /// conflicts with the chunked framing, and fails the request with error invalid_argument.
+    void request_chunked(const std::string &method, const std::string &path, const CaseInsensitiveMultimap &header, ContentProducer &&content_producer,
+                         std::function<void(std::shared_ptr<Response>, const error_code &)> &&request_callback) {
+      auto session = create_session(method, path, header, std::move(request_callback));
+      session->idempotent = false;
+      auto transfer_encoding = header.equal_range("Transfer-Encoding");
+      if(header.find("Content-Length") != header.end() ||
+         (transfer_encoding.first != transfer_encoding.second && (std::next(transfer_encoding.first) != transfer_encoding.second || !is_final_coding_chunked(transfer_encoding.first->second)))) {
+        post_error(session, make_error_code::make_error_code(errc::invalid_argument));
+        return;
       }
+      std::ostream write_stream(session->request_streambuf.get());
+      if(transfer_encoding.first == transfer_encoding.second)
+        write_stream << "Transfer-Encoding: chunked\r\n";
       write_stream << "\r\n";
-      if(content_length > 0)
-        write_stream << content.rdbuf();
+      session->content_producer = std::make_shared<ContentProducer>(std::move(content_producer));
+      connect_when_available(session);
+    }
 
-      connect(session);
+    /// Asynchronous request where the content is read from the file at path while it is sent.
+    /// On Linux, sendfile() is used for HTTP connections, given Boost 1.66 or Asio 1.12 and newer.
+    void request_file(const std::string &method, const std::string &path, const std::string &file_path, const CaseInsensitiveMultimap &header,
+                      std::function<void(std::shared_ptr<Response>, const error_code &)> &&request_callback) {
+      auto session = create_session(method, path, header, std::move(request_callback));
+      auto content_file = std::make_shared<ContentFile>(file_path);
+      if(!content_file->stream) {
+        post_error(session, make_error_code::make_error_code(errc::no_such_file_or_directory));
+        return;
+      }
+      write_header_end(session, content_file->size, header);
+      if(content_file->size > 0)
+        session->content_file = std::move(content_file);
+      connect_when_available(session);
     }
 
-    /// Asynchronous request where setting and/or running Client's io_service is required.
-    void request(const std::string &method, const std::string &path, std::istream &content,
-                 std::function<void(std::shared_ptr<Response>, const error_code &)> &&request_callback) {
-      request(method, path, content, CaseInsensitiveMultimap(), std::move(request_callback));
+    /// Asynchronous request that can be called from any thread while the io_service is run by start_io_threads().
+    /// The returned future throws system_error if the request failed.
+    std::future<std::shared_ptr<Response>> request_async(const std::string &method, const std::string &path = std::string("/"),
+                                                         string_view content = "", const CaseInsensitiveMultimap &header = CaseInsensitiveMultimap()) {
+      std::shared_ptr<std::promise<std::shared_ptr<Response>>> promise;
+      auto session = create_promise_session(method, path, header, promise);
+      write_request(session, content, header);
+      post_session(session);
+      return promise->get_future();
+    }
+
+    /// Asynchronous request that can be called from any thread while the io_service is run by start_io_threads().
+    /// The returned future throws system_error if the request failed.
+    std::future<std::shared_ptr<Response>> request_async(const std::string &method, const std::string &path, std::istream &content,
+                                                         const CaseInsensitiveMultimap &header = CaseInsensitiveMultimap()) {
+      std::shared_ptr<std::promise<std::shared_ptr<Response>>> promise;
+      auto session = create_promise_session(method, path, header, promise);
+      write_request(session, content, header);
+      post_session(session);
+      return promise->get_future();
+    }
+
+    /// Starts threads that run the internal io_service, creating it if it is not set.
+    /// Throws system_error with operation_not_supported if io_service was set by the user: it is then run by the user's
+    /// threads, and these threads could not be stopped by stop_io_threads() or the destructor while it has other work.
+    /// While the threads are running, request_async() and the synchronous request functions can be called from any thread,
+    /// and share the connections of this client. The exception is request callbacks and other handlers run by these threads,
+    /// where waiting for a request would deadlock: the synchronous request functions then throw system_error with
+    /// resource_deadlock_would_occur, and the future returned by request_async() must not be waited for.
+    void start_io_threads(std::size_t thread_count = 1) {
+      create_io_service();
+      if(!internal_io_service)
+        throw system_error(make_error_code::make_error_code(errc::operation_not_supported));
+      std::unique_lock<std::mutex> lock(io_threads_mutex);
+      if(io_threads.empty() && io_service->stopped())
+        io_service->reset();
+      if(!io_service_work)
+        io_service_work = std::unique_ptr<asio::io_service::work>(new asio::io_service::work(*io_service));
+      for(std::size_t c = 0; c < thread_count; ++c) {
+        io_threads.emplace_back([this] {
+          this->io_service->run();
+        });
+      }
+    }
+
+    /// Waits for the requests in progress to complete, and joins the threads started by start_io_threads().
+    /// Do not call from a request callback.
+    void stop_io_threads() {
+      std::vector<std::thread> threads;
+      {
+        std::unique_lock<std::mutex> lock(io_threads_mutex);
+        io_service_work = nullptr;
+        threads = std::move(io_threads);
+        io_threads.clear();
+      }
+      for(auto &thread : threads)
+        thread.join();
     }
 
-    /// Close connections
+    /// Returns resolve and connect statistics
+    ConnectStatistics connect_statistics() noexcept {
+      std::unique_lock<std::mutex> lock(resolve_mutex);
+      return statistics;
+    }
+
+    /// Close connections, and cancel queued requests
     void stop() noexcept {
       std::unique_lock<std::mutex> lock(connections_mutex);
-      for(auto it = connections.begin(); it != connections.end();) {
+      SessionRelease release;
+      auto stopped_connections = std::move(connections);
+      connections.clear();
+      for(auto &connection : stopped_connections) {
         error_code ec;
-        (*it)->socket->lowest_layer().cancel(ec);
-        it = connections.erase(it);
+        connection->socket->lowest_layer().cancel(ec);
+        if(auto connect_attempts = connection->connect_attempts.lock())
+          connect_attempts->cancel();
+        // The first session in the pipeline is called back by its canceled read, write or connect handler, or, if it is still
+        // resolving or connecting, when that completes
+        if(!connection->pipeline.empty()) {
+          auto session = connection->pipeline.front();
+          abandon_connection(connection, make_error_code::make_error_code(errc::operation_canceled), release, session);
+        }
+      }
+      idle_connections.clear();
+
+      for(auto &session : pending_sessions)
+        release.failed_sessions.emplace_back(session, make_error_code::make_error_code(errc::operation_canceled));
+      pending_sessions.clear();
+
+      auto handler_runner = this->handler_runner;
+      for(auto &failed_session : release.failed_sessions) {
+        auto session = failed_session.first;
+        io_service->post([handler_runner, session] {
+          auto lock = handler_runner->continue_lock();
+          if(!lock)
+            return;
+          session->callback(session->connection, make_error_code::make_error_code(errc::operation_canceled));
+        });
       }
     }
 
     virtual ~ClientBase() noexcept {
+      stop_handlers();
+    }
+
+  protected:
+    /// Stops the handlers, cancels the requests, and joins the threads started by start_io_threads().
+    /// Called first in the destructors of this class and of derived classes with members used by the handlers,
+    /// such that no handler runs while these members are destroyed.
+    void stop_handlers() noexcept {
       handler_runner->stop();
       stop();
+      std::unique_lock<std::mutex> lock(io_threads_mutex);
+      if(!io_threads.empty()) {
+        io_service_work = nullptr;
+        io_service->stop();
+        for(auto &thread : io_threads)
+          thread.join();
+        io_threads.clear();
+      }
     }
 
-  protected:
     bool internal_io_service = false;
 
     std::string host;
@@ -380,7 +826,21 @@ namespace SimpleWeb {
 
     std::unique_ptr<asio::ip::tcp::resolver::query> query;
 
+    /// Cached resolved addresses, nullptr if not resolved or caching is disabled
+    std::shared_ptr<const std::vector<asio::ip::tcp::endpoint>> endpoints;
+    std::chrono::steady_clock::time_point endpoints_expiry;
+    bool resolving = false;
+    /// Callbacks waiting for the current address lookup
+    std::vector<std::function<void(const error_code &, const std::shared_ptr<const std::vector<asio::ip::tcp::endpoint>> &)>> resolve_callbacks;
+    ConnectStatistics statistics;
+    std::mutex resolve_mutex;
+
     std::unordered_set<std::shared_ptr<Connection>> connections;
+    /// Idle connections ordered by the time they were released, most recently used last
+    std::deque<std::shared_ptr<Connection>> idle_connections;
+    /// Sessions waiting for a connection
+    std::deque<std::shared_ptr<Session>> pending_sessions;
+    std::size_t requests_in_flight = 0;
     std::mutex connections_mutex;
 
     std::shared_ptr<ScopeRunner> handler_runner;
@@ -388,53 +848,607 @@ namespace SimpleWeb {
     std::size_t concurrent_synchronous_requests = 0;
     std::mutex concurrent_synchronous_requests_mutex;
 
+    std::vector<std::thread> io_threads;
+    std::unique_ptr<asio::io_service::work> io_service_work;
+    std::mutex io_threads_mutex;
+
+    class Batch {
+    public:
+      std::vector<BatchRequest> requests;
+      std::vector<BatchResult> results;
+      std::size_t max_concurrency;
+      std::size_t required_successes;
+      std::function<void(std::vector<BatchResult> &&)> callback;
+
+      std::size_t next = 0, in_progress = 0, completed = 0, successes = 0;
+      bool done = false;
+      std::mutex mutex;
+    };
+
     ClientBase(const std::string &host_port, unsigned short default_port) noexcept : default_port(default_port), handler_runner(new ScopeRunner()) {
       auto parsed_host_port = parse_host_port(host_port, default_port);
       host = parsed_host_port.first;
       port = parsed_host_port.second;
     }
 
-    std::shared_ptr<Connection> get_connection() noexcept {
-      std::shared_ptr<Connection> connection;
-      std::unique_lock<std::mutex> lock(connections_mutex);
+    /// Returns true if the last coding of the Transfer-Encoding header field value is chunked.
+    static bool is_final_coding_chunked(const std::string &transfer_encoding) noexcept {
+      auto begin = transfer_encoding.find_last_of(',');
+      begin = begin == std::string::npos ? 0 : begin + 1;
+      auto end = transfer_encoding.size();
+      while(begin < end && (transfer_encoding[begin] == ' ' || transfer_encoding[begin] == '\t'))
+        ++begin;
+      while(end > begin && (transfer_encoding[end - 1] == ' ' || transfer_encoding[end - 1] == '\t'))
+        --end;
+      return case_insensitive_equal(transfer_encoding.substr(begin, end - begin), "chunked");
+    }
 
-      if(!io_service) {
-        io_service = std::make_shared<asio::io_service>();
-        internal_io_service = true;
-      }
+    std::shared_ptr<Session> create_session(const std::string &method, const std::string &path, const CaseInsensitiveMultimap &header,
+                                            std::function<void(std::shared_ptr<Response>, const error_code &)> &&request_callback_) {
+      auto session = std::make_shared<Session>(config.max_response_streambuf_size, nullptr, create_request_header(method, path, header));
+      session->idempotent = method == "GET" || method == "HEAD" || method == "PUT" || method == "DELETE" || method == "OPTIONS" || method == "TRACE";
+      session->head = method == "HEAD";
+      auto response = session->response;
+      auto request_callback = std::make_shared<std::function<void(std::shared_ptr<Response>, const error_code &)>>(std::move(request_callback_));
+      std::weak_ptr<Session> session_weak(session); // To avoid cyclic reference
+      session->callback = [this, session_weak, response, request_callback](const std::shared_ptr<Connection> & /*connection*/, const error_code &ec) {
+        SessionRelease release;
+        auto session = session_weak.lock();
+        bool retried = session && this->release_session(session, ec, release);
+
+        if(!retried) {
+          if(session && session->header_callback)
+            this->end_content_stream(session, ec);
+          else if(*request_callback)
+            (*request_callback)(response, ec);
+        }
+
+        this->continue_release(release);
+      };
+      return session;
+    }
 
-      for(auto it = connections.begin(); it != connections.end(); ++it) {
-        if(!(*it)->in_use && !connection) {
-          connection = *it;
-          break;
+    std::shared_ptr<Session> create_promise_session(const std::string &method, const std::string &path, const CaseInsensitiveMultimap &header,
+                                                    std::shared_ptr<std::promise<std::shared_ptr<Response>>> &promise) {
+      promise = std::make_shared<std::promise<std::shared_ptr<Response>>>();
+      return create_session(method, path, header, [promise](std::shared_ptr<Response> response, const error_code &ec) {
+        if(ec)
+          promise->set_exception(std::make_exception_ptr(system_error(ec)));
+        else
+          promise->set_value(std::move(response));
+      });
+    }
+
+    /// Writes the Content-Length header field, unless given in header or the content is chunked, and the end of the request header
+    void write_header_end(const std::shared_ptr<Session> &session, std::size_t content_length, const CaseInsensitiveMultimap &header) {
+      std::ostream write_stream(session->request_streambuf.get());
+      if(content_length > 0) {
+        auto header_it = header.find("Content-Length");
+        if(header_it == header.end()) {
+          header_it = header.find("Transfer-Encoding");
+          if(header_it == header.end() || header_it->second != "chunked")
+            write_stream << "Content-Length: " << content_length << "\r\n";
         }
       }
-      if(!connection) {
-        connection = create_connection();
-        connections.emplace(connection);
+      write_stream << "\r\n";
+    }
+
+    /// Writes the end of the request header and the request content
+    void write_request(const std::shared_ptr<Session> &session, string_view content, const CaseInsensitiveMultimap &header) {
+      write_header_end(session, content.size(), header);
+      std::ostream write_stream(session->request_streambuf.get());
+      write_stream << content;
+    }
+
+    /// Writes the end of the request header and the request content
+    void write_request(const std::shared_ptr<Session> &session, std::istream &content, const CaseInsensitiveMultimap &header) {
+      content.seekg(0, std::ios::end);
+      auto content_length = content.tellg();
+      content.seekg(0, std::ios::beg);
+      write_header_end(session, content_length > 0 ? static_cast<std::size_t>(content_length) : 0, header);
+      if(content_length > 0) {
+        std::ostream write_stream(session->request_streambuf.get());
+        write_stream << content.rdbuf();
       }
-      connection->attempt_reconnect = true;
-      connection->in_use = true;
+    }
 
-      if(!query) {
-        if(config.proxy_server.empty())
-          query = std::unique_ptr<asio::ip::tcp::resolver::query>(new asio::ip::tcp::resolver::query(host, std::to_string(port)));
-        else {
-          auto proxy_host_port = parse_host_port(config.proxy_server, 8080);
-          query = std::unique_ptr<asio::ip::tcp::resolver::query>(new asio::ip::tcp::resolver::query(proxy_host_port.first, std::to_string(proxy_host_port.second)));
+    /// Starts the next requests of the batch, up to its max_concurrency
+    void request_batch_next(const std::shared_ptr<Batch> &batch) {
+      std::vector<std::size_t> indices;
+      {
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        while(!batch->done && batch->in_progress < batch->max_concurrency && batch->next < batch->requests.size()) {
+          indices.emplace_back(batch->next++);
+          ++batch->in_progress;
         }
       }
-
-      return connection;
+      for(auto index : indices) {
+        auto &request = batch->requests[index];
+        this->request(request.method, request.path, request.content, request.header, [this, batch, index](std::shared_ptr<Response> response, const error_code &ec) {
+          std::function<void(std::vector<BatchResult> &&)> callback;
+          std::vector<BatchResult> results;
+          {
+            std::unique_lock<std::mutex> lock(batch->mutex);
+            --batch->in_progress;
+            if(batch->done)
+              return;
+            batch->results[index].response = std::move(response);
+            batch->results[index].ec = ec;
+            ++batch->completed;
+            if(!ec)
+              ++batch->successes;
+            if(batch->completed == batch->requests.size() || (batch->required_successes > 0 && batch->successes == batch->required_successes)) {
+              batch->done = true;
+              callback = std::move(batch->callback);
+              results = std::move(batch->results);
+            }
+          }
+          if(callback)
+            callback(std::move(results));
+          else
+            this->request_batch_next(batch);
+        });
+      }
     }
 
-    virtual std::shared_ptr<Connection> create_connection() noexcept = 0;
-    virtual void connect(const std::shared_ptr<Session> &) = 0;
+    /// Returns true if the io_service is run by start_io_threads(). Throws system_error if called from one of these threads,
+    /// where waiting for a synchronous request would deadlock.
+    bool io_threads_running() {
+      std::unique_lock<std::mutex> lock(io_threads_mutex);
+      auto id = std::this_thread::get_id();
+      for(auto &thread : io_threads) {
+        if(thread.get_id() == id)
+          throw system_error(make_error_code::make_error_code(errc::resource_deadlock_would_occur));
+      }
+      return !io_threads.empty();
+    }
 
-    std::unique_ptr<asio::streambuf> create_request_header(const std::string &method, const std::string &path, const CaseInsensitiveMultimap &header) const {
-      auto corrected_path = path;
-      if(corrected_path == "")
-        corrected_path = "/";
+    void create_io_service() {
+      std::unique_lock<std::mutex> lock(connections_mutex);
+      if(!io_service) {
+        io_service = std::make_shared<asio::io_service>();
+        internal_io_service = true;
+      }
+    }
+
+    /// Calls the callback of a session that could not be started from the io_service
+    void post_error(const std::shared_ptr<Session> &session, const error_code &ec) {
+      create_io_service();
+      auto handler_runner = this->handler_runner;
+      io_service->post([handler_runner, session, ec] {
+        auto lock = handler_runner->continue_lock();
+        if(!lock)
+          return;
+        session->callback(session->connection, ec);
+      });
+    }
+
+    /// Connects the session from the io_service, so that sockets are only used from the threads running the io_service
+    void post_session(const std::shared_ptr<Session> &session) {
+      create_io_service();
+      auto handler_runner = this->handler_runner;
+      io_service->post([this, handler_runner, session] {
+        auto lock = handler_runner->continue_lock();
+        if(!lock)
+          return;
+        this->connect_when_available(session);
+      });
+    }
+
+    /// Connects the session through an idle, active or new connection, or queues the session until a connection is available.
+    void connect_when_available(const std::shared_ptr<Session> &session) {
+      {
+        std::unique_lock<std::mutex> lock(connections_mutex);
+        if(!assign_connection(session)) {
+          pending_sessions.emplace_back(session);
+          return;
+        }
+      }
+      start_session(session);
+    }
+
+    /// Assigns the most recently used idle connection, an active connection if the request can be pipelined,
+    /// or a new connection to the session.
+    /// Returns false if max_connections or max_requests_in_flight is reached.
+    /// connections_mutex must be locked.
+    bool assign_connection(const std::shared_ptr<Session> &session) noexcept {
+      if(!io_service) {
+        io_service = std::make_shared<asio::io_service>();
+        internal_io_service = true;
+      }
+
+      if(!query) {
+        if(config.proxy_server.empty())
+          query = std::unique_ptr<asio::ip::tcp::resolver::query>(new asio::ip::tcp::resolver::query(host, std::to_string(port)));
+        else {
+          auto proxy_host_port = parse_host_port(config.proxy_server, 8080);
+          query = std::unique_ptr<asio::ip::tcp::resolver::query>(new asio::ip::tcp::resolver::query(proxy_host_port.first, std::to_string(proxy_host_port.second)));
+        }
+      }
+
+      if(config.max_requests_in_flight > 0 && requests_in_flight >= config.max_requests_in_flight)
+        return false;
+
+      remove_expired_idle_connections();
+
+      std::shared_ptr<Connection> connection;
+      while(!connection && !idle_connections.empty()) {
+        connection = std::move(idle_connections.back());
+        idle_connections.pop_back();
+        if(connection->is_stale()) {
+          connections.erase(connection);
+          connection = nullptr;
+        }
+      }
+      if(!connection && session->idempotent && config.max_pipelined_requests > 1) {
+        // Non-idempotent requests are only sent on connections without other requests in their pipeline,
+        // so the first session of a pipeline shows if the connection can be pipelined on
+        for(auto &active_connection : connections) {
+          if(active_connection->in_use && active_connection->keep_alive && active_connection->pipeline.front()->idempotent &&
+             active_connection->pipeline.size() < config.max_pipelined_requests) {
+            connection = active_connection;
+            break;
+          }
+        }
+      }
+      if(!connection) {
+        if(config.max_connections > 0 && connections.size() >= config.max_connections)
+          return false;
+        connection = create_connection();
+        connections.emplace(connection);
+      }
+      session->pipelined = !connection->pipeline.empty();
+      connection->pipeline.emplace_back(session);
+      connection->in_use = true;
+      session->connection = std::move(connection);
+      ++requests_in_flight;
+
+      return true;
+    }
+
+    /// Connects, or for a pipelined session writes the request on the already connected connection.
+    void start_session(const std::shared_ptr<Session> &session) {
+      if(session->pipelined)
+        write(session);
+      else
+        connect(session);
+    }
+
+    /// Removes a finished session from its connection. The connection is returned to the idle connections
+    /// when its pipeline is empty. On error, the connection is closed and the sessions in its pipeline are
+    /// either retried or failed. Queued sessions are then assigned a connection if possible.
+    /// Returns true if the given session is retried on another connection.
+    bool release_session(const std::shared_ptr<Session> &session, const error_code &ec, SessionRelease &release) noexcept {
+      std::unique_lock<std::mutex> lock(connections_mutex);
+      auto connection = session->connection;
+      if(!connection || connection->failed) // Queued session that was canceled, or session of a stopped or lost connection
+        return false;
+
+      bool retried = false;
+      if(!ec) {
+        --requests_in_flight;
+        connection->pipeline.pop_front();
+        if(connection->pipeline_written > 0)
+          --connection->pipeline_written;
+
+        auto &response = *session->response;
+        auto header_it = response.header.find("Connection");
+        if(response.http_version < "1.1" || (header_it != response.header.end() && case_insensitive_equal(header_it->second, "close")))
+          connection->keep_alive = false;
+
+        if(!connection->pipeline.empty()) {
+          if(connection->keep_alive)
+            release.read_session = connection->pipeline.front();
+          else
+            abandon_connection(connection, asio::error::connection_reset, release);
+        }
+        else {
+          connection->in_use = false;
+          connection->reading = false;
+          if(connection->keep_alive && connection->socket->lowest_layer().is_open()) {
+            connection->idle_time = std::chrono::steady_clock::now();
+            idle_connections.emplace_back(connection);
+          }
+          else
+            connections.erase(connection);
+        }
+      }
+      else
+        retried = abandon_connection(connection, ec, release, session);
+
+      while(!pending_sessions.empty() && assign_connection(pending_sessions.front())) {
+        release.start_sessions.emplace_back(std::move(pending_sessions.front()));
+        pending_sessions.pop_front();
+      }
+
+      remove_expired_idle_connections();
+      return retried;
+    }
+
+    /// Removes a connection that can no longer be used. Idempotent sessions in its pipeline that have not
+    /// received a response are queued to be retried once, and the other sessions, except session, are added to
+    /// release.failed_sessions. The pipeline is cleared, and session, whose callback is handled by the caller,
+    /// is the only session left referring to the connection. Returns true if session is retried.
+    /// connections_mutex must be locked.
+    bool abandon_connection(const std::shared_ptr<Connection> &connection, const error_code &ec, SessionRelease &release,
+                            const std::shared_ptr<Session> &session = nullptr) noexcept {
+      connection->failed = true;
+      connections.erase(connection);
+
+      bool retried = false;
+      auto retry = ec == asio::error::eof || ec == asio::error::connection_reset || ec == asio::error::connection_aborted || ec == asio::error::broken_pipe;
+      auto position = pending_sessions.begin();
+      for(auto &pipeline_session : connection->pipeline) {
+        --requests_in_flight;
+        if(pipeline_session != session)
+          pipeline_session->connection = nullptr;
+        auto &response = *pipeline_session->response;
+        if(retry && pipeline_session->idempotent && !pipeline_session->retried && response.status_code.empty()) {
+          pipeline_session->retried = true;
+          response.streambuf.consume(response.streambuf.size());
+          position = pending_sessions.emplace(position, pipeline_session) + 1;
+          if(pipeline_session == session)
+            retried = true;
+        }
+        else if(pipeline_session != session)
+          release.failed_sessions.emplace_back(pipeline_session, ec);
+      }
+      connection->pipeline.clear();
+      connection->pipeline_written = 0;
+      connection->in_use = false;
+      return retried;
+    }
+
+    void continue_release(const SessionRelease &release) {
+      for(auto &failed_session : release.failed_sessions)
+        failed_session.first->callback(failed_session.first->connection, failed_session.second);
+      if(release.read_session)
+        read(release.read_session);
+      for(auto &session : release.start_sessions)
+        start_session(session);
+    }
+
+    /// Closes least recently used idle connections exceeding max_idle_connections or timeout_idle.
+    /// connections_mutex must be locked.
+    void remove_expired_idle_connections() noexcept {
+      auto now = std::chrono::steady_clock::now();
+      while(!idle_connections.empty() &&
+            (idle_connections.size() > config.max_idle_connections ||
+             (config.timeout_idle > 0 && idle_connections.size() > config.min_idle_connections &&
+              now - idle_connections.front()->idle_time >= std::chrono::seconds(config.timeout_idle)))) {
+        connections.erase(idle_connections.front());
+        idle_connections.pop_front();
+      }
+    }
+
+    /// Runs io_service until done is set by the synchronous request's callback.
+    /// Another thread's io_service->run() might process the request, so work keeps io_service from running out
+    /// of work until the callback, which resets work, has been called.
+    void run_synchronous_request(const bool &done, std::unique_ptr<asio::io_service::work> &work) {
+      std::unique_lock<std::mutex> lock(concurrent_synchronous_requests_mutex);
+      if(!done)
+        work = std::unique_ptr<asio::io_service::work>(new asio::io_service::work(*io_service));
+      while(!done) {
+        ++concurrent_synchronous_requests;
+        lock.unlock();
+        io_service->run();
+        lock.lock();
+        --concurrent_synchronous_requests;
+        if(!concurrent_synchronous_requests)
+          io_service->reset();
+      }
+    }
+
+    virtual std::shared_ptr<Connection> create_connection() noexcept = 0;
+    virtual void connect(const std::shared_ptr<Session> &) = 0;
+
+    /// Resolves the server, or proxy server, and connects the TCP socket of the session's connection.
+    void resolve_and_connect(const std::shared_ptr<Session> &session, std::function<void(const error_code &)> &&callback) {
+      auto callback_ptr = std::make_shared<std::function<void(const error_code &)>>(std::move(callback));
+      resolve([this, session, callback_ptr](const error_code &ec, const std::shared_ptr<const std::vector<asio::ip::tcp::endpoint>> &endpoints) {
+        if(!ec)
+          this->connect_endpoints(session, endpoints, std::move(*callback_ptr));
+        else
+          (*callback_ptr)(ec);
+      });
+    }
+
+    /// Calls callback with cached addresses if available, and resolves the addresses if they are missing or expired.
+    void resolve(std::function<void(const error_code &, const std::shared_ptr<const std::vector<asio::ip::tcp::endpoint>> &)> &&callback) {
+      std::unique_lock<std::mutex> lock(resolve_mutex);
+      if(endpoints) {
+        auto cached_endpoints = endpoints;
+        ++statistics.resolve_cache_hits;
+        bool refresh = !resolving && std::chrono::steady_clock::now() >= endpoints_expiry;
+        if(refresh)
+          resolving = true;
+        lock.unlock();
+        if(refresh)
+          async_resolve();
+        callback(error_code(), cached_endpoints);
+        return;
+      }
+
+      resolve_callbacks.emplace_back(std::move(callback));
+      if(!resolving) {
+        resolving = true;
+        lock.unlock();
+        async_resolve();
+      }
+    }
+
+    void async_resolve() {
+      auto resolver = std::make_shared<asio::ip::tcp::resolver>(*io_service);
+      auto start_time = std::chrono::steady_clock::now();
+      auto handler_runner = this->handler_runner;
+      resolver->async_resolve(*query, [this, resolver, start_time, handler_runner](const error_code &ec, asio::ip::tcp::resolver::iterator it) {
+        auto lock = handler_runner->continue_lock();
+        if(!lock)
+          return;
+
+        std::shared_ptr<const std::vector<asio::ip::tcp::endpoint>> resolved_endpoints;
+        if(!ec) {
+          std::vector<asio::ip::tcp::endpoint> endpoints;
+          for(; it != asio::ip::tcp::resolver::iterator(); ++it)
+            endpoints.emplace_back(it->endpoint());
+          resolved_endpoints = std::make_shared<const std::vector<asio::ip::tcp::endpoint>>(interleave_address_families(endpoints));
+        }
+
+        decltype(this->resolve_callbacks) callbacks;
+        {
+          std::unique_lock<std::mutex> lock(this->resolve_mutex);
+          this->resolving = false;
+          auto now = std::chrono::steady_clock::now();
+          ++this->statistics.resolves;
+          this->statistics.last_resolve_time = now - start_time;
+          this->statistics.total_resolve_time += this->statistics.last_resolve_time;
+          if(resolved_endpoints) {
+            if(this->config.resolve_cache_ttl > 0) {
+              this->endpoints = resolved_endpoints;
+              this->endpoints_expiry = now + std::chrono::seconds(this->config.resolve_cache_ttl);
+            }
+            else
+              this->endpoints = nullptr;
+          }
+          // On error, expired cached addresses are kept and resolved again on the next connect
+          callbacks.swap(this->resolve_callbacks);
+        }
+        for(auto &callback : callbacks)
+          callback(ec, resolved_endpoints);
+      });
+    }
+
+    /// Returns endpoints with alternating address families, starting with the family of the first endpoint (RFC 8305)
+    static std::vector<asio::ip::tcp::endpoint> interleave_address_families(const std::vector<asio::ip::tcp::endpoint> &endpoints) {
+      std::vector<asio::ip::tcp::endpoint> first_family, second_family;
+      for(auto &endpoint : endpoints) {
+        if(first_family.empty() || endpoint.protocol() == first_family.front().protocol())
+          first_family.emplace_back(endpoint);
+        else
+          second_family.emplace_back(endpoint);
+      }
+      std::vector<asio::ip::tcp::endpoint> result;
+      result.reserve(endpoints.size());
+      for(std::size_t c = 0; c < first_family.size() || c < second_family.size(); ++c) {
+        if(c < first_family.size())
+          result.emplace_back(first_family[c]);
+        if(c < second_family.size())
+          result.emplace_back(second_family[c]);
+      }
+      return result;
+    }
+
+    /// Connects to one of the endpoints. A new connection attempt is started every
+    /// Config::connection_attempt_delay milliseconds, or when the previous attempt fails,
+    /// and the first successful attempt is moved into the TCP socket of the session's connection.
+    void connect_endpoints(const std::shared_ptr<Session> &session, const std::shared_ptr<const std::vector<asio::ip::tcp::endpoint>> &endpoints,
+                           std::function<void(const error_code &)> &&callback) {
+      if(endpoints->empty()) {
+        callback(make_error_code::make_error_code(errc::address_not_available));
+        return;
+      }
+
+      auto attempts = std::make_shared<ConnectAttempts>(endpoints, std::move(callback));
+      {
+        std::unique_lock<std::mutex> lock(connections_mutex);
+        if(session->connection->failed) { // Stopped while resolving
+          lock.unlock();
+          attempts->callback(make_error_code::make_error_code(errc::operation_canceled));
+          return;
+        }
+        session->connection->connect_attempts = attempts;
+      }
+
+      auto timeout = config.timeout_connect != 0 ? config.timeout_connect : config.timeout;
+      if(timeout > 0) {
+        std::unique_lock<std::mutex> lock(attempts->mutex);
+        attempts->timeout_timer = std::unique_ptr<asio::steady_timer>(new asio::steady_timer(*io_service));
+        attempts->timeout_timer->expires_from_now(std::chrono::seconds(timeout));
+        attempts->timeout_timer->async_wait([attempts](const error_code &ec) {
+          if(!ec)
+            attempts->cancel();
+        });
+      }
+
+      start_connect_attempt(session, attempts);
+    }
+
+    void start_connect_attempt(const std::shared_ptr<Session> &session, const std::shared_ptr<ConnectAttempts> &attempts) {
+      std::unique_lock<std::mutex> lock(attempts->mutex);
+      if(attempts->done)
+        return;
+      if(attempts->canceled || attempts->sockets.size() >= attempts->endpoints->size()) {
+        if(attempts->pending == 0) { // Canceled between two attempts
+          attempts->done = true;
+          lock.unlock();
+          attempts->callback(make_error_code::make_error_code(errc::operation_canceled));
+        }
+        return;
+      }
+
+      auto index = attempts->sockets.size();
+      attempts->sockets.emplace_back(new asio::ip::tcp::socket(*io_service));
+      ++attempts->pending;
+      attempts->sockets.back()->async_connect((*attempts->endpoints)[index], [this, session, attempts, index](const error_code &ec) {
+        auto lock = session->connection->handler_runner->continue_lock();
+        if(!lock)
+          return;
+        this->finish_connect_attempt(session, attempts, index, ec);
+      });
+
+      if(index + 1 < attempts->endpoints->size()) {
+        if(!attempts->delay_timer)
+          attempts->delay_timer = std::unique_ptr<asio::steady_timer>(new asio::steady_timer(*io_service));
+        attempts->delay_timer->expires_from_now(std::chrono::milliseconds(config.connection_attempt_delay));
+        attempts->delay_timer->async_wait([this, session, attempts](const error_code &ec) {
+          if(ec)
+            return;
+          auto lock = session->connection->handler_runner->continue_lock();
+          if(!lock)
+            return;
+          this->start_connect_attempt(session, attempts);
+        });
+      }
+    }
+
+    void finish_connect_attempt(const std::shared_ptr<Session> &session, const std::shared_ptr<ConnectAttempts> &attempts, std::size_t index, const error_code &ec) {
+      std::unique_lock<std::mutex> lock(attempts->mutex);
+      --attempts->pending;
+      if(attempts->done)
+        return;
+
+      if(!ec) {
+        attempts->done = true;
+        auto socket = std::move(attempts->sockets[index]);
+        attempts->cancel_attempts();
+        lock.unlock();
+
+        {
+          std::unique_lock<std::mutex> lock(resolve_mutex);
+          ++statistics.connects;
+          statistics.last_connect_time = std::chrono::steady_clock::now() - attempts->start_time;
+          statistics.total_connect_time += statistics.last_connect_time;
+        }
+
+        session->connection->tcp_socket() = std::move(*socket);
+        attempts->callback(ec);
+      }
+      else if(!attempts->canceled && attempts->sockets.size() < attempts->endpoints->size()) {
+        lock.unlock();
+        start_connect_attempt(session, attempts);
+      }
+      else if(attempts->pending == 0) {
+        attempts->done = true;
+        attempts->cancel_attempts();
+        lock.unlock();
+        attempts->callback(ec);
+      }
+    }
+
+    std::unique_ptr<asio::streambuf> create_request_header(const std::string &method, const std::string &path, const CaseInsensitiveMultimap &header) const {
+      auto corrected_path = path;
+      if(corrected_path == "")
+        corrected_path = "/";
       if(!config.proxy_server.empty() && std::is_same<socket_type, asio::ip::tcp::socket>::value)
         corrected_path = "http://" + host + ':' + std::to_string(port) + corrected_path;
 
@@ -447,6 +1461,10 @@ namespace SimpleWeb {
       write_stream << "\r\n";
       for(auto &h : header)
         write_stream << h.first << ": " << h.second << "\r\n";
+#ifdef HAVE_ZLIB
+      if(config.accept_encoding && header.find("Accept-Encoding") == header.end())
+        write_stream << "Accept-Encoding: gzip, deflate\r\n";
+#endif
       return streambuf;
     }
 
@@ -464,46 +1482,219 @@ namespace SimpleWeb {
       return parsed_host_port;
     }
 
+    /// Called when the session's connection is connected, or when a pipelined session is assigned to an active connection.
     void write(const std::shared_ptr<Session> &session) {
-      session->connection->set_timeout();
-      asio::async_write(*session->connection->socket, session->request_streambuf->data(), [this, session](const error_code &ec, std::size_t /*bytes_transferred*/) {
-        session->connection->cancel_timeout();
-        auto lock = session->connection->handler_runner->continue_lock();
+      write_pipeline(session->connection, !session->pipelined ? session : nullptr);
+    }
+
+    /// Writes the requests in the connection's pipeline that have not yet been written, in one vectored write.
+    /// connected_session is the session that connected the connection, if called after connecting.
+    void write_pipeline(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Session> &connected_session = nullptr) {
+      std::vector<asio::const_buffer> buffers;
+      std::vector<std::shared_ptr<Session>> sessions; // Keeps the request stream buffers alive during the write
+      std::shared_ptr<Session> content_session;
+      bool reading;
+      {
+        std::unique_lock<std::mutex> lock(connections_mutex);
+        if(connected_session)
+          connection->connected = true;
+        if(connection->failed) {
+          // Stopped while connecting, where the connecting session was left to be called back by its connect handler
+          if(connected_session && connected_session->connection == connection) {
+            lock.unlock();
+            connected_session->callback(connection, make_error_code::make_error_code(errc::operation_canceled));
+          }
+          return;
+        }
+        if(!connection->connected || connection->writing)
+          return;
+        for(auto i = connection->pipeline_written; i < connection->pipeline.size(); ++i) {
+          auto &session = connection->pipeline[i];
+          buffers.emplace_back(session->request_streambuf->data());
+          buffers.insert(buffers.end(), session->content_buffers.begin(), session->content_buffers.end());
+          sessions.emplace_back(session);
+          if(session->content_file || session->content_producer) { // The content is written after the buffers, and the following requests after the content
+            content_session = session;
+            break;
+          }
+        }
+        if(sessions.empty())
+          return;
+        connection->pipeline_written += sessions.size();
+        connection->writing = true;
+        reading = connection->reading;
+      }
+
+      if(!reading) // Otherwise, the timeout of the current read also covers this write
+        connection->set_timeout();
+      asio::async_write(*connection->socket, buffers, make_memory_handler(connection, [this, connection, sessions, content_session, reading](const error_code &ec, std::size_t /*bytes_transferred*/) {
+        if(!ec && content_session) {
+          auto lock = connection->handler_runner->continue_lock();
+          if(!lock)
+            return;
+          std::function<void(const error_code &)> callback = [this, connection, reading](const error_code &ec) {
+            this->write_pipeline_done(connection, ec, reading);
+          };
+          if(content_session->content_file)
+            this->write_file(connection, content_session, std::move(callback));
+          else
+            this->write_produced_content(connection, content_session, std::make_shared<std::function<void(const error_code &)>>(std::move(callback)));
+        }
+        else
+          this->write_pipeline_done(connection, ec, reading);
+      }));
+    }
+
+    /// Called when the requests of a write_pipeline() call have been written
+    void write_pipeline_done(const std::shared_ptr<Connection> &connection, const error_code &ec, bool reading) {
+      if(!reading)
+        connection->cancel_timeout();
+      auto lock = connection->handler_runner->continue_lock();
+      if(!lock)
+        return;
+      std::shared_ptr<Session> read_session, error_session;
+      bool write_more = false;
+      {
+        std::unique_lock<std::mutex> lock(this->connections_mutex);
+        connection->writing = false;
+        if(connection->failed)
+          return;
+        if(!ec) {
+          write_more = connection->pipeline_written < connection->pipeline.size();
+          if(!connection->reading && !connection->pipeline.empty()) {
+            connection->reading = true;
+            read_session = connection->pipeline.front();
+          }
+        }
+        else if(!connection->reading) // Otherwise, the current read fails as well, and handles the lost connection
+          error_session = connection->pipeline.front();
+      }
+      if(error_session)
+        error_session->callback(error_session->connection, ec);
+      if(write_more)
+        this->write_pipeline(connection);
+      if(read_session)
+        this->read(read_session);
+    }
+
+    /// Writes the chunks given by the content producer of the session, one chunk at a time, and calls callback when done
+    void write_produced_content(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Session> &session,
+                                const std::shared_ptr<std::function<void(const error_code &)>> &callback) {
+      auto called = std::make_shared<bool>(false);
+      (*session->content_producer)([this, connection, session, callback, called](string_view part) {
+        if(*called)
+          return;
+        *called = true;
+        auto chunk = std::make_shared<asio::streambuf>();
+        std::ostream stream(chunk.get());
+        stream << std::hex << part.size() << "\r\n" // The last chunk is "0\r\n\r\n", with no trailer fields
+               << part << "\r\n";
+        bool last = part.empty();
+        asio::async_write(*connection->socket, chunk->data(), make_memory_handler(connection, [this, connection, session, callback, chunk, last](const error_code &ec, std::size_t /*bytes_transferred*/) {
+          auto lock = connection->handler_runner->continue_lock();
+          if(!lock)
+            return;
+          if(ec || last)
+            (*callback)(ec);
+          else
+            this->write_produced_content(connection, session, callback);
+        }));
+      });
+    }
+
+    /// Writes the content file of the session, and calls callback when done.
+    /// Called from a handler, and callback is called from a handler or from this function.
+    virtual void write_file(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Session> &session, std::function<void(const error_code &)> &&callback) {
+      auto content_file = session->content_file;
+      content_file->stream.clear();
+      content_file->stream.seekg(0, std::ios::beg); // The request might be retried on a new connection
+      write_file_part(connection, content_file, std::make_shared<std::vector<char>>(65536), 0,
+                      std::make_shared<std::function<void(const error_code &)>>(std::move(callback)));
+    }
+
+    void write_file_part(const std::shared_ptr<Connection> &connection, const std::shared_ptr<ContentFile> &content_file, const std::shared_ptr<std::vector<char>> &buffer,
+                         std::size_t offset, const std::shared_ptr<std::function<void(const error_code &)>> &callback) {
+      auto size = std::min(buffer->size(), content_file->size - offset);
+      if(size == 0) {
+        (*callback)(error_code());
+        return;
+      }
+      content_file->stream.read(buffer->data(), static_cast<std::streamsize>(size));
+      if(static_cast<std::size_t>(content_file->stream.gcount()) != size) {
+        (*callback)(make_error_code::make_error_code(errc::io_error));
+        return;
+      }
+      asio::async_write(*connection->socket, asio::buffer(buffer->data(), size), make_memory_handler(connection, [this, connection, content_file, buffer, offset, size, callback](const error_code &ec, std::size_t /*bytes_transferred*/) {
+        auto lock = connection->handler_runner->continue_lock();
         if(!lock)
           return;
         if(!ec)
-          this->read(session);
+          this->write_file_part(connection, content_file, buffer, offset + size, callback);
         else
-          session->callback(session->connection, ec);
-      });
+          (*callback)(ec);
+      }));
+    }
+
+    /// Moves up to size bytes from the connection's read buffer to the response stream buffer.
+    /// Returns the number of bytes moved, which is less than size if the read buffer has less data or the response stream buffer is full.
+    static std::size_t move_read_buffer(asio::streambuf &read_buffer, asio::streambuf &streambuf, std::size_t size) {
+      size = std::min(std::min(size, read_buffer.size()), streambuf.max_size() - streambuf.size());
+      streambuf.commit(asio::buffer_copy(streambuf.prepare(size), read_buffer.data(), size));
+      read_buffer.consume(size);
+      return size;
     }
 
     void read(const std::shared_ptr<Session> &session) {
       session->connection->set_timeout();
-      asio::async_read_until(*session->connection->socket, session->response->streambuf, "\r\n\r\n", [this, session](const error_code &ec, std::size_t bytes_transferred) {
+      asio::async_read_until(*session->connection->socket, session->connection->read_buffer, "\r\n\r\n", make_memory_handler(session->connection, [this, session](const error_code &ec, std::size_t /*bytes_transferred*/) {
         session->connection->cancel_timeout();
         auto lock = session->connection->handler_runner->continue_lock();
         if(!lock)
           return;
-        if((!ec || ec == asio::error::not_found) && session->response->streambuf.size() == session->response->streambuf.max_size()) {
+        auto &read_buffer = session->connection->read_buffer;
+        if((!ec || ec == asio::error::not_found) && read_buffer.size() == read_buffer.max_size()) {
           session->callback(session->connection, make_error_code::make_error_code(errc::message_size));
           return;
         }
         if(!ec) {
-          session->connection->attempt_reconnect = true;
-          std::size_t num_additional_bytes = session->response->streambuf.size() - bytes_transferred;
-
-          if(!ResponseMessage::parse(session->response->content, session->response->http_version, session->response->status_code, session->response->header)) {
+          std::istream stream(&read_buffer);
+          if(!ResponseMessage::parse(stream, session->response->http_version, session->response->status_code, session->response->header)) {
             session->callback(session->connection, make_error_code::make_error_code(errc::protocol_error));
             return;
           }
 
+#ifdef HAVE_ZLIB
+          if(config.accept_encoding && !session->head) {
+            auto header_it = session->response->header.find("Content-Encoding");
+            if(header_it != session->response->header.end()) {
+              if(case_insensitive_equal(header_it->second, "gzip") || case_insensitive_equal(header_it->second, "x-gzip"))
+                session->decoder = std::unique_ptr<ContentDecoder>(new ContentDecoder(true));
+              else if(case_insensitive_equal(header_it->second, "deflate"))
+                session->decoder = std::unique_ptr<ContentDecoder>(new ContentDecoder(false));
+            }
+          }
+          if(session->header_callback || session->decoder) {
+#else
+          if(session->header_callback) {
+#endif
+            this->start_content_stream(session);
+            return;
+          }
+
+          auto &streambuf = session->response->streambuf;
           auto header_it = session->response->header.find("Content-Length");
-          if(header_it != session->response->header.end()) {
+          if(session->head)
+            session->callback(session->connection, ec);
+          else if(header_it != session->response->header.end()) {
             auto content_length = stoull(header_it->second);
-            if(content_length > num_additional_bytes) {
+            auto moved = move_read_buffer(read_buffer, streambuf, content_length);
+            if(content_length > moved) {
+              if(streambuf.size() == streambuf.max_size()) {
+                session->callback(session->connection, make_error_code::make_error_code(errc::message_size));
+                return;
+              }
               session->connection->set_timeout();
-              asio::async_read(*session->connection->socket, session->response->streambuf, asio::transfer_exactly(content_length - num_additional_bytes), [session](const error_code &ec, std::size_t /*bytes_transferred*/) {
+              asio::async_read(*session->connection->socket, streambuf, asio::transfer_exactly(content_length - moved), make_memory_handler(session->connection, [session](const error_code &ec, std::size_t /*bytes_transferred*/) {
                 session->connection->cancel_timeout();
                 auto lock = session->connection->handler_runner->continue_lock();
                 if(!lock)
@@ -517,18 +1708,21 @@ namespace SimpleWeb {
                 }
                 else
                   session->callback(session->connection, ec);
-              });
+              }));
             }
             else
               session->callback(session->connection, ec);
           }
-          else if((header_it = session->response->header.find("Transfer-Encoding")) != session->response->header.end() && header_it->second == "chunked") {
-            auto chunks_streambuf = std::make_shared<asio::streambuf>(this->config.max_response_streambuf_size);
-            this->read_chunked_transfer_encoded(session, chunks_streambuf);
-          }
-          else if(session->response->http_version < "1.1" || ((header_it = session->response->header.find("Session")) != session->response->header.end() && header_it->second == "close")) {
+          else if((header_it = session->response->header.find("Transfer-Encoding")) != session->response->header.end() && header_it->second == "chunked")
+            this->read_chunked_transfer_encoded(session, std::make_shared<ChunkedDecoder>());
+          else if(session->response->http_version < "1.1" || ((header_it = session->response->header.find("Connection")) != session->response->header.end() && case_insensitive_equal(header_it->second, "close"))) {
+            move_read_buffer(read_buffer, streambuf, read_buffer.size());
+            if(streambuf.size() == streambuf.max_size()) {
+              session->callback(session->connection, make_error_code::make_error_code(errc::message_size));
+              return;
+            }
             session->connection->set_timeout();
-            asio::async_read(*session->connection->socket, session->response->streambuf, [session](const error_code &ec, std::size_t /*bytes_transferred*/) {
+            asio::async_read(*session->connection->socket, streambuf, make_memory_handler(session->connection, [session](const error_code &ec, std::size_t /*bytes_transferred*/) {
               session->connection->cancel_timeout();
               auto lock = session->connection->handler_runner->continue_lock();
               if(!lock)
@@ -542,114 +1736,274 @@ namespace SimpleWeb {
               }
               else
                 session->callback(session->connection, ec == asio::error::eof ? error_code() : ec);
-            });
+            }));
           }
           else
             session->callback(session->connection, ec);
         }
-        else {
-          if(session->connection->attempt_reconnect && ec != asio::error::operation_aborted) {
-            std::unique_lock<std::mutex> lock(connections_mutex);
-            auto it = connections.find(session->connection);
-            if(it != connections.end()) {
-              connections.erase(it);
-              session->connection = create_connection();
-              session->connection->attempt_reconnect = false;
-              session->connection->in_use = true;
-              connections.emplace(session->connection);
-              lock.unlock();
-              this->connect(session);
-            }
-            else {
-              lock.unlock();
-              session->callback(session->connection, ec);
-            }
-          }
-          else
-            session->callback(session->connection, ec);
-        }
-      });
+        else
+          session->callback(session->connection, ec);
+      }));
     }
 
-    void read_chunked_transfer_encoded(const std::shared_ptr<Session> &session, const std::shared_ptr<asio::streambuf> &chunks_streambuf) {
+    /// Decodes the chunked transfer encoded content in the connection's read buffer to the response stream buffer. The rest of
+    /// the content is then read into the put area of the response stream buffer, where it is decoded in place.
+    void read_chunked_transfer_encoded(const std::shared_ptr<Session> &session, const std::shared_ptr<ChunkedDecoder> &decoder) {
+      auto &read_buffer = session->connection->read_buffer;
+      auto &streambuf = session->response->streambuf;
+      while(read_buffer.size() > 0) {
+        if(streambuf.size() == streambuf.max_size()) {
+          session->callback(session->connection, make_error_code::make_error_code(errc::message_size));
+          return;
+        }
+        auto size = std::min(read_buffer.size(), streambuf.max_size() - streambuf.size());
+        std::size_t consumed;
+        streambuf.commit(decoder->decode(asio::buffer_cast<const char *>(read_buffer.data()), size, asio::buffer_cast<char *>(streambuf.prepare(size)), consumed));
+        read_buffer.consume(consumed);
+        if(chunked_transfer_encoded_decoded(session, decoder))
+          return;
+      }
+
+      if(streambuf.size() == streambuf.max_size()) {
+        session->callback(session->connection, make_error_code::make_error_code(errc::message_size));
+        return;
+      }
+      // Read sizes grow with the content, from 512 bytes up to 64 KiB
+      auto buffer = streambuf.prepare(std::min(std::min<std::size_t>(std::max<std::size_t>(512, streambuf.size()), 65536), streambuf.max_size() - streambuf.size()));
       session->connection->set_timeout();
-      asio::async_read_until(*session->connection->socket, session->response->streambuf, "\r\n", [this, session, chunks_streambuf](const error_code &ec, size_t bytes_transferred) {
+      session->connection->socket->async_read_some(buffer, make_memory_handler(session->connection, [this, session, decoder, buffer](const error_code &ec, std::size_t bytes_transferred) {
         session->connection->cancel_timeout();
         auto lock = session->connection->handler_runner->continue_lock();
         if(!lock)
           return;
-        if((!ec || ec == asio::error::not_found) && session->response->streambuf.size() == session->response->streambuf.max_size()) {
-          session->callback(session->connection, make_error_code::make_error_code(errc::message_size));
-          return;
-        }
         if(!ec) {
-          std::string line;
-          getline(session->response->content, line);
-          bytes_transferred -= line.size() + 1;
-          line.pop_back();
-          unsigned long length = 0;
-          try {
-            length = stoul(line, 0, 16);
-          }
-          catch(...) {
-            session->callback(session->connection, make_error_code::make_error_code(errc::protocol_error));
-            return;
-          }
-
-          auto num_additional_bytes = session->response->streambuf.size() - bytes_transferred;
-
-          if((2 + length) > num_additional_bytes) {
-            session->connection->set_timeout();
-            asio::async_read(*session->connection->socket, session->response->streambuf, asio::transfer_exactly(2 + length - num_additional_bytes), [this, session, chunks_streambuf, length](const error_code &ec, size_t /*bytes_transferred*/) {
-              session->connection->cancel_timeout();
-              auto lock = session->connection->handler_runner->continue_lock();
-              if(!lock)
-                return;
-              if(!ec) {
-                if(session->response->streambuf.size() == session->response->streambuf.max_size()) {
-                  session->callback(session->connection, make_error_code::make_error_code(errc::message_size));
-                  return;
-                }
-                this->read_chunked_transfer_encoded_chunk(session, chunks_streambuf, length);
-              }
-              else
-                session->callback(session->connection, ec);
-            });
+          auto data = asio::buffer_cast<char *>(buffer);
+          std::size_t consumed;
+          session->response->streambuf.commit(decoder->decode(data, bytes_transferred, data, consumed));
+          if(consumed < bytes_transferred) { // The rest of the bytes are the start of the next response
+            auto &read_buffer = session->connection->read_buffer;
+            auto size = std::min(bytes_transferred - consumed, read_buffer.max_size() - read_buffer.size());
+            read_buffer.commit(asio::buffer_copy(read_buffer.prepare(size), asio::buffer(data + consumed, size)));
           }
-          else
-            this->read_chunked_transfer_encoded_chunk(session, chunks_streambuf, length);
+          if(!this->chunked_transfer_encoded_decoded(session, decoder))
+            this->read_chunked_transfer_encoded(session, decoder);
         }
         else
           session->callback(session->connection, ec);
-      });
+      }));
     }
 
-    void read_chunked_transfer_encoded_chunk(const std::shared_ptr<Session> &session, const std::shared_ptr<asio::streambuf> &chunks_streambuf, unsigned long length) {
-      std::ostream tmp_stream(chunks_streambuf.get());
-      if(length > 0) {
-        std::unique_ptr<char[]> buffer(new char[length]);
-        session->response->content.read(buffer.get(), static_cast<std::streamsize>(length));
-        tmp_stream.write(buffer.get(), static_cast<std::streamsize>(length));
-        if(chunks_streambuf->size() == chunks_streambuf->max_size()) {
-          session->callback(session->connection, make_error_code::make_error_code(errc::message_size));
+    /// Calls the session callback and returns true if the chunked transfer encoded content is complete or invalid.
+    bool chunked_transfer_encoded_decoded(const std::shared_ptr<Session> &session, const std::shared_ptr<ChunkedDecoder> &decoder) {
+      if(decoder->error() != ChunkedDecoder::Error::none) {
+        session->callback(session->connection, make_error_code::make_error_code(decoder->error() == ChunkedDecoder::Error::too_large ? errc::message_size : errc::protocol_error));
+        return true;
+      }
+      if(decoder->complete()) {
+        for(auto &field : decoder->trailer)
+          session->response->header.emplace(field.first, field.second);
+        session->callback(session->connection, error_code());
+        return true;
+      }
+      return false;
+    }
+
+    /// Called when the header of a streamed response has been received
+    void start_content_stream(const std::shared_ptr<Session> &session) {
+      using ContentState = typename Session::ContentState;
+      auto &header = session->response->header;
+      auto header_it = header.find("Content-Length");
+      auto content_state = ContentState::complete;
+      if(session->head) {
+      }
+      else if(header_it != header.end()) {
+        try {
+          session->content_remaining = stoull(header_it->second);
+        }
+        catch(...) {
+          session->callback(session->connection, make_error_code::make_error_code(errc::protocol_error));
           return;
         }
+        if(session->content_remaining > 0)
+          content_state = ContentState::length;
       }
+      else if((header_it = header.find("Transfer-Encoding")) != header.end() && header_it->second == "chunked") {
+        content_state = ContentState::chunked;
+        session->chunked_decoder = std::unique_ptr<ChunkedDecoder>(new ChunkedDecoder());
+      }
+      else if(session->response->http_version < "1.1" || ((header_it = header.find("Connection")) != header.end() && case_insensitive_equal(header_it->second, "close")))
+        content_state = ContentState::until_eof;
 
-      // Remove "\r\n"
-      session->response->content.get();
-      session->response->content.get();
+#ifdef HAVE_ZLIB
+      if(session->decoder) {
+        header.erase("Content-Encoding");
+        header.erase("Content-Length");
+      }
+#endif
 
-      if(length > 0)
-        read_chunked_transfer_encoded(session, chunks_streambuf);
+      if(content_state == ContentState::complete) // Release the connection before calling header_callback, through end_content_stream()
+        session->callback(session->connection, error_code());
       else {
-        if(chunks_streambuf->size() > 0) {
-          std::ostream ostream(&session->response->streambuf);
-          ostream << chunks_streambuf.get();
+        session->content_state = content_state;
+        if(session->header_callback)
+          session->header_callback(session->response, error_code());
+        else // The whole content is read to the response stream buffer while it is decompressed
+          read_content_part(session);
+      }
+    }
+
+    /// Returns the stream buffer that received content is read into
+    asio::streambuf &content_streambuf(const std::shared_ptr<Session> &session) noexcept {
+#ifdef HAVE_ZLIB
+      if(session->decoder)
+        return session->decoder->input;
+#endif
+      return session->response->streambuf;
+    }
+
+    /// Called when a streamed response is complete or has failed
+    void end_content_stream(const std::shared_ptr<Session> &session, const error_code &ec) {
+      auto content_state = session->content_state;
+      session->content_state = Session::ContentState::complete;
+      if(session->content_callback) {
+        auto callback = std::move(session->content_callback);
+        session->content_callback = nullptr;
+        callback(ec, !ec);
+      }
+      else if(content_state == Session::ContentState::header)
+        session->header_callback(session->response, ec);
+    }
+
+    void read_content(const std::shared_ptr<Session> &session, std::function<void(const error_code &, bool)> &&callback) {
+      if(session->content_state == Session::ContentState::complete) {
+        callback(error_code(), true);
+        return;
+      }
+      {
+        std::unique_lock<std::mutex> lock(connections_mutex);
+        if(!session->connection || session->connection->failed) { // Stopped while waiting for read_content()
+          lock.unlock();
+          callback(make_error_code::make_error_code(errc::operation_canceled), false);
+          return;
         }
-        error_code ec;
-        session->callback(session->connection, ec);
       }
+      session->content_callback = std::move(callback);
+      read_content_part(session);
+    }
+
+    /// Reads the next part of a streamed response content into the response stream buffer, and removes the chunked
+    /// transfer coding if used. Calls session->content_callback when content has been read.
+    void read_content_part(const std::shared_ptr<Session> &session) {
+      using ContentState = typename Session::ContentState;
+      auto &read_buffer = session->connection->read_buffer;
+      auto &streambuf = content_streambuf(session);
+      if(streambuf.size() == streambuf.max_size()) {
+        session->callback(session->connection, make_error_code::make_error_code(errc::message_size));
+        return;
+      }
+      auto size = std::min(config.max_content_part_size, streambuf.max_size() - streambuf.size());
+      if(session->content_state == ContentState::length && session->content_remaining < size)
+        size = static_cast<std::size_t>(session->content_remaining);
+
+      if(session->content_state == ContentState::chunked) {
+        auto &decoder = *session->chunked_decoder;
+        // The decoded content is never larger than the bytes consumed, and is written directly to the stream buffer
+        while(read_buffer.size() > 0) {
+          auto input_size = std::min(read_buffer.size(), size);
+          std::size_t consumed;
+          auto decoded = decoder.decode(asio::buffer_cast<const char *>(read_buffer.data()), input_size, asio::buffer_cast<char *>(streambuf.prepare(input_size)), consumed);
+          streambuf.commit(decoded);
+          read_buffer.consume(consumed);
+          if(decoded > 0 || decoder.complete() || decoder.error() != ChunkedDecoder::Error::none) {
+            content_part_read(session, decoded);
+            return;
+          }
+        }
+      }
+      else if(read_buffer.size() > 0) {
+        content_part_read(session, move_read_buffer(read_buffer, streambuf, size));
+        return;
+      }
+
+      auto buffer = streambuf.prepare(size);
+      session->connection->set_timeout();
+      session->connection->socket->async_read_some(buffer, make_memory_handler(session->connection, [this, session, buffer](const error_code &ec, std::size_t bytes_transferred) {
+        session->connection->cancel_timeout();
+        auto lock = session->connection->handler_runner->continue_lock();
+        if(!lock)
+          return;
+        if(!ec) {
+          auto &streambuf = this->content_streambuf(session);
+          if(session->content_state == ContentState::chunked) { // Decoded in place
+            auto data = asio::buffer_cast<char *>(buffer);
+            std::size_t consumed;
+            auto decoded = session->chunked_decoder->decode(data, bytes_transferred, data, consumed);
+            streambuf.commit(decoded);
+            if(consumed < bytes_transferred) { // The rest of the bytes are the start of the next response
+              auto &read_buffer = session->connection->read_buffer;
+              auto size = std::min(bytes_transferred - consumed, read_buffer.max_size() - read_buffer.size());
+              read_buffer.commit(asio::buffer_copy(read_buffer.prepare(size), asio::buffer(data + consumed, size)));
+            }
+            this->content_part_read(session, decoded);
+          }
+          else {
+            streambuf.commit(bytes_transferred);
+            this->content_part_read(session, bytes_transferred);
+          }
+        }
+        else if(ec == asio::error::eof && session->content_state == ContentState::until_eof)
+          this->content_complete(session);
+        else
+          session->callback(session->connection, ec);
+      }));
+    }
+
+    /// Called when the whole content of a streamed response has been received
+    void content_complete(const std::shared_ptr<Session> &session) {
+#ifdef HAVE_ZLIB
+      if(session->decoder && !session->decoder->finished()) { // Truncated compressed content
+        session->callback(session->connection, make_error_code::make_error_code(errc::protocol_error));
+        return;
+      }
+#endif
+      session->callback(session->connection, error_code());
+    }
+
+    /// Called when bytes of a streamed response content have been added to the response stream buffer
+    void content_part_read(const std::shared_ptr<Session> &session, std::size_t bytes) {
+      auto &decoder = session->chunked_decoder;
+      if(session->content_state == Session::ContentState::length)
+        session->content_remaining -= bytes;
+      else if(session->content_state == Session::ContentState::chunked && decoder->error() != ChunkedDecoder::Error::none) {
+        session->callback(session->connection, make_error_code::make_error_code(decoder->error() == ChunkedDecoder::Error::too_large ? errc::message_size : errc::protocol_error));
+        return;
+      }
+#ifdef HAVE_ZLIB
+      if(session->decoder) {
+        auto ec = session->decoder->decode(session->response->streambuf);
+        if(ec) {
+          session->callback(session->connection, ec);
+          return;
+        }
+      }
+#endif
+      if(session->content_state == Session::ContentState::length && session->content_remaining == 0) {
+        content_complete(session);
+        return;
+      }
+      if(session->content_state == Session::ContentState::chunked && decoder->complete()) {
+        for(auto &field : decoder->trailer)
+          session->response->header.emplace(field.first, field.second);
+        content_complete(session);
+        return;
+      }
+      if(!session->header_callback || bytes == 0) { // Chunk size lines only are not passed on
+        read_content_part(session);
+        return;
+      }
+      auto callback = std::move(session->content_callback);
+      session->content_callback = nullptr;
+      callback(error_code(), false);
     }
   };
 
@@ -665,34 +2019,17 @@ namespace SimpleWeb {
 
   protected:
     std::shared_ptr<Connection> create_connection() noexcept override {
-      return std::make_shared<Connection>(handler_runner, config.timeout, *io_service);
+      return std::make_shared<Connection>(handler_runner, config.timeout, config.max_response_streambuf_size, *io_service);
     }
 
     void connect(const std::shared_ptr<Session> &session) override {
       if(!session->connection->socket->lowest_layer().is_open()) {
-        auto resolver = std::make_shared<asio::ip::tcp::resolver>(*io_service);
-        session->connection->set_timeout(config.timeout_connect);
-        resolver->async_resolve(*query, [this, session, resolver](const error_code &ec, asio::ip::tcp::resolver::iterator it) {
-          session->connection->cancel_timeout();
-          auto lock = session->connection->handler_runner->continue_lock();
-          if(!lock)
-            return;
+        resolve_and_connect(session, [this, session](const error_code &ec) {
           if(!ec) {
-            session->connection->set_timeout(config.timeout_connect);
-            asio::async_connect(*session->connection->socket, it, [this, session, resolver](const error_code &ec, asio::ip::tcp::resolver::iterator /*it*/) {
-              session->connection->cancel_timeout();
-              auto lock = session->connection->handler_runner->continue_lock();
-              if(!lock)
-                return;
-              if(!ec) {
-                asio::ip::tcp::no_delay option(true);
-                error_code ec;
-                session->connection->socket->set_option(option, ec);
-                this->write(session);
-              }
-              else
-                session->callback(session->connection, ec);
-            });
+            asio::ip::tcp::no_delay option(true);
+            error_code ec;
+            session->connection->socket->set_option(option, ec);
+            this->write(session);
           }
           else
             session->callback(session->connection, ec);
@@ -701,6 +2038,59 @@ namespace SimpleWeb {
       else
         write(session);
     }
+
+#ifdef SIMPLE_WEB_SENDFILE
+    void write_file(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Session> &session, std::function<void(const error_code &)> &&callback) override {
+      int fd = ::open(session->content_file->path.c_str(), O_RDONLY | O_CLOEXEC);
+      if(fd < 0) {
+        callback(error_code(errno, asio::error::get_system_category()));
+        return;
+      }
+      std::shared_ptr<int> file(new int(fd), [](int *fd) {
+        ::close(*fd);
+        delete fd;
+      });
+      error_code ec;
+      connection->socket->native_non_blocking(true, ec);
+      if(ec) {
+        callback(ec);
+        return;
+      }
+      // The socket is returned to blocking mode when the file has been sent
+      auto restoring_callback = std::make_shared<std::function<void(const error_code &)>>([connection, callback](const error_code &ec) {
+        error_code ignored_ec;
+        connection->socket->native_non_blocking(false, ignored_ec);
+        callback(ec);
+      });
+      send_file(connection, file, std::make_shared<off_t>(0), session->content_file->size, restoring_callback);
+    }
+
+    /// Sends the file with sendfile() until the socket would block, and then waits until the socket is writable
+    void send_file(const std::shared_ptr<Connection> &connection, const std::shared_ptr<int> &file, const std::shared_ptr<off_t> &offset, std::size_t size,
+                   const std::shared_ptr<std::function<void(const error_code &)>> &callback) {
+      while(static_cast<std::size_t>(*offset) < size) {
+        auto result = ::sendfile(connection->socket->native_handle(), *file, offset.get(), size - static_cast<std::size_t>(*offset));
+        if(result > 0 || (result < 0 && errno == EINTR))
+          continue;
+        if(result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          connection->socket->async_wait(asio::ip::tcp::socket::wait_write, [this, connection, file, offset, size, callback](const error_code &ec) {
+            auto lock = connection->handler_runner->continue_lock();
+            if(!lock)
+              return;
+            if(!ec)
+              this->send_file(connection, file, offset, size, callback);
+            else
+              (*callback)(ec);
+          });
+          return;
+        }
+        // The file could not be read, or has become smaller
+        (*callback)(result < 0 ? error_code(errno, asio::error::get_system_category()) : make_error_code::make_error_code(errc::io_error));
+        return;
+      }
+      (*callback)(error_code());
+    }
+#endif
   };
 } // namespace SimpleWeb
 
@@ -9,12 +9,24 @@
 #include <boost/asio/ssl.hpp>
 #endif
 
+#include <ctime>
+#include <openssl/ssl.h>
+
 namespace SimpleWeb {
   using HTTPS = asio::ssl::stream<asio::ip::tcp::socket>;
 
   template <>
   class Client<HTTPS> : public ClientBase<HTTPS> {
   public:
+    /// TLS session resumption statistics
+    class TlsSessionStatistics {
+    public:
+      /// Number of handshakes where a cached session was resumed
+      std::size_t resumed = 0;
+      /// Number of full handshakes, either without a cached session or where the server declined it
+      std::size_t full = 0;
+    };
+
     Client(const std::string &server_port_path, bool verify_certificate = true, const std::string &cert_file = std::string(),
            const std::string &private_key_file = std::string(), const std::string &verify_file = std::string())
         : ClientBase<HTTPS>::ClientBase(server_port_path, 443), context(asio::ssl::context::tlsv12) {
@@ -35,82 +47,140 @@ namespace SimpleWeb {
         context.set_verify_mode(asio::ssl::verify_peer);
       else
         context.set_verify_mode(asio::ssl::verify_none);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+      // Sessions are given to new_session() instead of the internal cache, which is not used by clients
+      SSL_CTX_set_ex_data(context.native_handle(), client_ex_data_index(), this);
+      SSL_CTX_set_session_cache_mode(context.native_handle(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+      SSL_CTX_sess_set_new_cb(context.native_handle(), &Client<HTTPS>::new_session);
+#endif
+    }
+
+    ~Client() noexcept {
+      // The handlers use the members of this class, and must be stopped before these are destroyed
+      stop_handlers();
+      // Connections might keep the SSL_CTX after this client is destroyed
+      SSL_CTX_set_ex_data(context.native_handle(), client_ex_data_index(), nullptr);
+    }
+
+    /// Returns TLS session resumption statistics
+    TlsSessionStatistics tls_session_statistics() noexcept {
+      std::unique_lock<std::mutex> lock(tls_sessions_mutex);
+      return tls_statistics;
     }
 
   protected:
     asio::ssl::context context;
 
+    /// Sessions received from the server, most recent last
+    std::deque<std::shared_ptr<SSL_SESSION>> tls_sessions;
+    TlsSessionStatistics tls_statistics;
+    std::mutex tls_sessions_mutex;
+
+    static int client_ex_data_index() noexcept {
+      static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+      return index;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    /// Called by OpenSSL when a session, or a TLS 1.3 ticket, has been received
+    static int new_session(SSL *ssl, SSL_SESSION *ssl_session) {
+      auto client = static_cast<Client<HTTPS> *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), client_ex_data_index()));
+      if(!client)
+        return 0;
+      std::unique_lock<std::mutex> lock(client->tls_sessions_mutex);
+      if(client->config.max_tls_sessions == 0)
+        return 0;
+      // A copy is kept since OpenSSL marks the session as not resumable if the connection is closed without a TLS shutdown
+      auto copy = SSL_SESSION_dup(ssl_session);
+      if(!copy)
+        return 0;
+      client->tls_sessions.emplace_back(copy, SSL_SESSION_free);
+      while(client->tls_sessions.size() > client->config.max_tls_sessions)
+        client->tls_sessions.pop_front();
+      return 0;
+    }
+#endif
+
+    /// Returns the most recent resumable session, or nullptr. TLS 1.3 tickets are only used once,
+    /// while older sessions are kept and a copy is returned. Always returns nullptr before OpenSSL 1.1.1,
+    /// where the session cache is disabled.
+    std::shared_ptr<SSL_SESSION> take_tls_session() noexcept {
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+      std::unique_lock<std::mutex> lock(tls_sessions_mutex);
+      auto now = static_cast<long>(std::time(nullptr));
+      while(!tls_sessions.empty()) {
+        auto tls_session = tls_sessions.back();
+        if(SSL_SESSION_is_resumable(tls_session.get()) && SSL_SESSION_get_time(tls_session.get()) + SSL_SESSION_get_timeout(tls_session.get()) > now) {
+          if(SSL_SESSION_get_protocol_version(tls_session.get()) == TLS1_3_VERSION) {
+            tls_sessions.pop_back();
+            return tls_session;
+          }
+          auto copy = SSL_SESSION_dup(tls_session.get());
+          return copy ? std::shared_ptr<SSL_SESSION>(copy, SSL_SESSION_free) : nullptr;
+        }
+        tls_sessions.pop_back();
+      }
+#endif
+      return nullptr;
+    }
+
     std::shared_ptr<Connection> create_connection() noexcept override {
-      return std::make_shared<Connection>(handler_runner, config.timeout, *io_service, context);
+      return std::make_shared<Connection>(handler_runner, config.timeout, config.max_response_streambuf_size, *io_service, context);
     }
 
     void connect(const std::shared_ptr<Session> &session) override {
       if(!session->connection->socket->lowest_layer().is_open()) {
-        auto resolver = std::make_shared<asio::ip::tcp::resolver>(*io_service);
-        resolver->async_resolve(*query, [this, session, resolver](const error_code &ec, asio::ip::tcp::resolver::iterator it) {
-          auto lock = session->connection->handler_runner->continue_lock();
-          if(!lock)
-            return;
+        resolve_and_connect(session, [this, session](const error_code &ec) {
           if(!ec) {
-            session->connection->set_timeout(this->config.timeout_connect);
-            asio::async_connect(session->connection->socket->lowest_layer(), it, [this, session, resolver](const error_code &ec, asio::ip::tcp::resolver::iterator /*it*/) {
-              session->connection->cancel_timeout();
-              auto lock = session->connection->handler_runner->continue_lock();
-              if(!lock)
-                return;
-              if(!ec) {
-                asio::ip::tcp::no_delay option(true);
-                error_code ec;
-                session->connection->socket->lowest_layer().set_option(option, ec);
-
-                if(!this->config.proxy_server.empty()) {
-                  auto write_buffer = std::make_shared<asio::streambuf>();
-                  std::ostream write_stream(write_buffer.get());
-                  auto host_port = this->host + ':' + std::to_string(this->port);
-                  write_stream << "CONNECT " + host_port + " HTTP/1.1\r\n"
-                               << "Host: " << host_port << "\r\n\r\n";
+            asio::ip::tcp::no_delay option(true);
+            error_code ec;
+            session->connection->socket->lowest_layer().set_option(option, ec);
+
+            if(!this->config.proxy_server.empty()) {
+              auto write_buffer = std::make_shared<asio::streambuf>();
+              std::ostream write_stream(write_buffer.get());
+              auto host_port = this->host + ':' + std::to_string(this->port);
+              write_stream << "CONNECT " + host_port + " HTTP/1.1\r\n"
+                           << "Host: " << host_port << "\r\n\r\n";
+              session->connection->set_timeout(this->config.timeout_connect);
+              asio::async_write(session->connection->socket->next_layer(), *write_buffer, [this, session, write_buffer](const error_code &ec, std::size_t /*bytes_transferred*/) {
+                session->connection->cancel_timeout();
+                auto lock = session->connection->handler_runner->continue_lock();
+                if(!lock)
+                  return;
+                if(!ec) {
+                  std::shared_ptr<Response> response(new Response(this->config.max_response_streambuf_size));
                   session->connection->set_timeout(this->config.timeout_connect);
-                  asio::async_write(session->connection->socket->next_layer(), *write_buffer, [this, session, write_buffer](const error_code &ec, std::size_t /*bytes_transferred*/) {
+                  asio::async_read_until(session->connection->socket->next_layer(), response->streambuf, "\r\n\r\n", [this, session, response](const error_code &ec, std::size_t /*bytes_transferred*/) {
                     session->connection->cancel_timeout();
                     auto lock = session->connection->handler_runner->continue_lock();
                     if(!lock)
                       return;
+                    if((!ec || ec == asio::error::not_found) && response->streambuf.size() == response->streambuf.max_size()) {
+                      session->callback(session->connection, make_error_code::make_error_code(errc::message_size));
+                      return;
+                    }
                     if(!ec) {
-                      std::shared_ptr<Response> response(new Response(this->config.max_response_streambuf_size));
-                      session->connection->set_timeout(this->config.timeout_connect);
-                      asio::async_read_until(session->connection->socket->next_layer(), response->streambuf, "\r\n\r\n", [this, session, response](const error_code &ec, std::size_t /*bytes_transferred*/) {
-                        session->connection->cancel_timeout();
-                        auto lock = session->connection->handler_runner->continue_lock();
-                        if(!lock)
-                          return;
-                        if((!ec || ec == asio::error::not_found) && response->streambuf.size() == response->streambuf.max_size()) {
-                          session->callback(session->connection, make_error_code::make_error_code(errc::message_size));
-                          return;
-                        }
-                        if(!ec) {
-                          if(!ResponseMessage::parse(response->content, response->http_version, response->status_code, response->header))
-                            session->callback(session->connection, make_error_code::make_error_code(errc::protocol_error));
-                          else {
-                            if(response->status_code.empty() || response->status_code.compare(0, 3, "200") != 0)
-                              session->callback(session->connection, make_error_code::make_error_code(errc::permission_denied));
-                            else
-                              this->handshake(session);
-                          }
-                        }
+                      if(!ResponseMessage::parse(response->content, response->http_version, response->status_code, response->header))
+                        session->callback(session->connection, make_error_code::make_error_code(errc::protocol_error));
+                      else {
+                        if(response->status_code.empty() || response->status_code.compare(0, 3, "200") != 0)
+                          session->callback(session->connection, make_error_code::make_error_code(errc::permission_denied));
                         else
-                          session->callback(session->connection, ec);
-                      });
+                          this->handshake(session);
+                      }
                     }
                     else
                       session->callback(session->connection, ec);
                   });
                 }
                 else
-                  this->handshake(session);
-              }
-              else
-                session->callback(session->connection, ec);
-            });
+                  session->callback(session->connection, ec);
+              });
+            }
+            else
+              this->handshake(session);
           }
           else
             session->callback(session->connection, ec);
@@ -122,6 +192,8 @@ namespace SimpleWeb {
 
     void handshake(const std::shared_ptr<Session> &session) {
       SSL_set_tlsext_host_name(session->connection->socket->native_handle(), this->host.c_str());
+      if(auto tls_session = take_tls_session())
+        SSL_set_session(session->connection->socket->native_handle(), tls_session.get());
 
       session->connection->set_timeout(this->config.timeout_connect);
       session->connection->socket->async_handshake(asio::ssl::stream_base::client, [this, session](const error_code &ec) {
@@ -129,8 +201,16 @@ namespace SimpleWeb {
         auto lock = session->connection->handler_runner->continue_lock();
         if(!lock)
           return;
-        if(!ec)
+        if(!ec) {
+          {
+            std::unique_lock<std::mutex> lock(this->tls_sessions_mutex);
+            if(SSL_session_reused(session->connection->socket->native_handle()))
+              ++this->tls_statistics.resumed;
+            else
+              ++this->tls_statistics.full;
+          }
           this->write(session);
+        }
         else
           session->callback(session->connection, ec);
       });
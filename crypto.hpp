@@ -1,17 +1,40 @@
 #ifndef SIMPLE_WEB_CRYPTO_HPP
 #define SIMPLE_WEB_CRYPTO_HPP
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iomanip>
+#include <limits>
 #include <istream>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
-#include <openssl/buffer.h>
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
-#include <openssl/md5.h>
-#include <openssl/sha.h>
+
+#if(defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SIMPLE_WEB_BASE64_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SIMPLE_WEB_CRYPTO_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace SimpleWeb {
 // TODO 2017: remove workaround for MSVS 2012
@@ -24,70 +47,718 @@ namespace SimpleWeb {
   class Crypto {
     const static std::size_t buffer_size = 131072;
 
+    static EVP_MD_CTX *new_md_context() noexcept {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+      return EVP_MD_CTX_create();
+#else
+      return EVP_MD_CTX_new();
+#endif
+    }
+
+    static void free_md_context(EVP_MD_CTX *context) noexcept {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+      EVP_MD_CTX_destroy(context);
+#else
+      EVP_MD_CTX_free(context);
+#endif
+    }
+
+    /// Digest context reused by each thread instead of allocating a context for every digest.
+    static EVP_MD_CTX *thread_md_context() noexcept {
+      thread_local std::unique_ptr<EVP_MD_CTX, void (*)(EVP_MD_CTX *)> context(new_md_context(), free_md_context);
+      return context.get();
+    }
+
+    /// Returns the digest of data, where the digest is recomputed from the previous digest for the given number of iterations.
+    static std::string digest(const EVP_MD *md, const void *data, std::size_t size, std::size_t iterations) noexcept {
+      auto context = thread_md_context();
+      std::string hash;
+      hash.resize(static_cast<std::size_t>(EVP_MD_size(md)));
+      EVP_DigestInit_ex(context, md, nullptr);
+      EVP_DigestUpdate(context, data, size);
+      EVP_DigestFinal_ex(context, reinterpret_cast<unsigned char *>(&hash[0]), nullptr);
+
+      for(std::size_t c = 1; c < iterations; ++c) {
+        EVP_DigestInit_ex(context, md, nullptr);
+        EVP_DigestUpdate(context, hash.data(), hash.size());
+        EVP_DigestFinal_ex(context, reinterpret_cast<unsigned char *>(&hash[0]), nullptr);
+      }
+
+      return hash;
+    }
+
+    /// Base64 encoding and decoding shared by Base64 and Base64Url.
+    /// Uses SSSE3 or AVX2 when supported by the processor, and falls back to a scalar implementation.
+    class Base64Codec {
+    public:
+      static std::size_t encoded_size(std::size_t size, bool url) noexcept {
+        return url ? (size * 4 + 2) / 3 : (size + 2) / 3 * 4;
+      }
+
+      static std::size_t decoded_size(const char *base64, std::size_t size) noexcept {
+        if(size % 4 == 0 && size > 0 && base64[size - 1] == '=')
+          size -= base64[size - 2] == '=' ? 2 : 1;
+        return size / 4 * 3 + (size % 4 == 0 ? 0 : size % 4 - 1);
+      }
+
+      static std::size_t encode(const unsigned char *input, std::size_t size, char *output, bool url) noexcept {
+        const char *chars = url ? "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+                                : "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::size_t i = 0;
+        auto out = output;
+#ifdef SIMPLE_WEB_BASE64_X86
+        if(simd_level() >= 2)
+          i = encode_avx2(input, size, out, url);
+        else if(simd_level() >= 1)
+          i = encode_ssse3(input, size, out, url);
+        out += i / 3 * 4;
+#endif
+        for(; i + 3 <= size; i += 3) {
+          std::uint32_t value = static_cast<std::uint32_t>(input[i]) << 16 | static_cast<std::uint32_t>(input[i + 1]) << 8 | input[i + 2];
+          *out++ = chars[value >> 18];
+          *out++ = chars[(value >> 12) & 0x3f];
+          *out++ = chars[(value >> 6) & 0x3f];
+          *out++ = chars[value & 0x3f];
+        }
+        if(i < size) {
+          std::uint32_t value = static_cast<std::uint32_t>(input[i]) << 16;
+          if(i + 1 < size)
+            value |= static_cast<std::uint32_t>(input[i + 1]) << 8;
+          *out++ = chars[value >> 18];
+          *out++ = chars[(value >> 12) & 0x3f];
+          if(i + 1 < size)
+            *out++ = chars[(value >> 6) & 0x3f];
+          else if(!url)
+            *out++ = '=';
+          if(!url)
+            *out++ = '=';
+        }
+        return static_cast<std::size_t>(out - output);
+      }
+
+      /// Returns std::string::npos if base64 is not valid.
+      /// Padding is required when url is false, and optional when url is true.
+      static std::size_t decode(const char *base64, std::size_t size, unsigned char *output, bool url) noexcept {
+        if(!url && size % 4 != 0)
+          return std::string::npos;
+        if(size % 4 == 0 && size > 0 && base64[size - 1] == '=')
+          size -= base64[size - 2] == '=' ? 2 : 1;
+        if(size % 4 == 1)
+          return std::string::npos;
+
+        const auto &values = decode_values(url);
+        auto full_size = size / 4 * 4;
+        std::size_t i = 0;
+        auto out = output;
+#ifdef SIMPLE_WEB_BASE64_X86
+        if(simd_level() >= 2)
+          i = decode_avx2(base64, full_size, out, url);
+        else if(simd_level() >= 1)
+          i = decode_ssse3(base64, full_size, out, url);
+        out += i / 4 * 3;
+#endif
+        for(; i < full_size; i += 4) {
+          auto v0 = values[static_cast<unsigned char>(base64[i])], v1 = values[static_cast<unsigned char>(base64[i + 1])];
+          auto v2 = values[static_cast<unsigned char>(base64[i + 2])], v3 = values[static_cast<unsigned char>(base64[i + 3])];
+          if((v0 | v1 | v2 | v3) & 0x80)
+            return std::string::npos;
+          *out++ = static_cast<unsigned char>(v0 << 2 | v1 >> 4);
+          *out++ = static_cast<unsigned char>(v1 << 4 | v2 >> 2);
+          *out++ = static_cast<unsigned char>(v2 << 6 | v3);
+        }
+        if(i < size) {
+          auto v0 = values[static_cast<unsigned char>(base64[i])], v1 = values[static_cast<unsigned char>(base64[i + 1])];
+          auto v2 = i + 2 < size ? values[static_cast<unsigned char>(base64[i + 2])] : 0;
+          if((v0 | v1 | v2) & 0x80)
+            return std::string::npos;
+          *out++ = static_cast<unsigned char>(v0 << 2 | v1 >> 4);
+          if(i + 2 < size)
+            *out++ = static_cast<unsigned char>(v1 << 4 | v2 >> 2);
+        }
+        return static_cast<std::size_t>(out - output);
+      }
+
+      /// Incremental encoder for input that arrives in parts.
+      class Encoder {
+        bool url;
+        unsigned char pending[2];
+        std::size_t pending_size = 0;
+
+      public:
+        Encoder(bool url) noexcept : url(url) {}
+
+        /// Appends the encoding of data to output. Trailing bytes that do not fill a group of three are kept until the next call.
+        void write(const char *data, std::size_t size, std::string &output) {
+          auto input = reinterpret_cast<const unsigned char *>(data);
+          if(pending_size > 0) {
+            while(pending_size < 2 && size > 0) {
+              pending[pending_size++] = *input++;
+              --size;
+            }
+            if(size == 0)
+              return;
+            unsigned char group[3] = {pending[0], pending[1], *input++};
+            --size;
+            pending_size = 0;
+            auto position = output.size();
+            output.resize(position + 4);
+            encode(group, 3, &output[position], url);
+          }
+          auto group_size = size / 3 * 3;
+          auto position = output.size();
+          output.resize(position + group_size / 3 * 4);
+          encode(input, group_size, &output[position], url);
+          for(auto c = group_size; c < size; ++c)
+            pending[pending_size++] = input[c];
+        }
+
+        /// Appends the remaining characters, including padding, to output.
+        void finish(std::string &output) {
+          auto position = output.size();
+          output.resize(position + encoded_size(pending_size, url));
+          encode(pending, pending_size, &output[position], url);
+          pending_size = 0;
+        }
+      };
+
+      /// Incremental decoder for input that arrives in parts.
+      class Decoder {
+        bool url;
+        char pending[4];
+        std::size_t pending_size = 0;
+        bool ended = false;
+        bool failed = false;
+
+        bool decode_groups(const char *base64, std::size_t size, std::string &output) {
+          if(size == 0)
+            return true;
+          if(ended)
+            return false;
+          auto position = output.size();
+          output.resize(position + decoded_size(base64, size));
+          if(decode(base64, size, reinterpret_cast<unsigned char *>(&output[position]), url) == std::string::npos) {
+            output.resize(position);
+            return false;
+          }
+          ended = base64[size - 1] == '=';
+          return true;
+        }
+
+      public:
+        Decoder(bool url) noexcept : url(url) {}
+
+        /// Appends the decoding of base64 to output. Trailing characters that do not fill a group of four are kept until the next call.
+        /// Returns false if the input is not valid.
+        bool write(const char *base64, std::size_t size, std::string &output) {
+          if(failed)
+            return false;
+          if(pending_size > 0) {
+            while(pending_size < 4 && size > 0) {
+              pending[pending_size++] = *base64++;
+              --size;
+            }
+            if(pending_size < 4)
+              return true;
+            pending_size = 0;
+            if(!decode_groups(pending, 4, output))
+              return !(failed = true);
+          }
+          auto group_size = size / 4 * 4;
+          if(!decode_groups(base64, group_size, output))
+            return !(failed = true);
+          for(auto c = group_size; c < size; ++c)
+            pending[pending_size++] = base64[c];
+          return true;
+        }
+
+        /// Appends the decoding of any remaining characters to output.
+        /// Returns false if the input was not valid.
+        bool finish(std::string &output) {
+          if(failed)
+            return false;
+          if(pending_size > 0 && (!url || !decode_groups(pending, pending_size, output)))
+            failed = true;
+          pending_size = 0;
+          return !failed;
+        }
+      };
+
+    private:
+      /// Maps characters to values, and invalid characters to 0xff
+      class DecodeValues {
+      public:
+        unsigned char values[256];
+
+        DecodeValues(bool url) noexcept {
+          std::memset(values, 0xff, sizeof(values));
+          for(unsigned char c = 0; c < 26; ++c) {
+            values['A' + c] = c;
+            values['a' + c] = static_cast<unsigned char>(26 + c);
+          }
+          for(unsigned char c = 0; c < 10; ++c)
+            values['0' + c] = static_cast<unsigned char>(52 + c);
+          values[static_cast<unsigned char>(url ? '-' : '+')] = 62;
+          values[static_cast<unsigned char>(url ? '_' : '/')] = 63;
+        }
+
+        unsigned char operator[](unsigned char c) const noexcept {
+          return values[c];
+        }
+      };
+
+      static const DecodeValues &decode_values(bool url) noexcept {
+        static const DecodeValues standard_values(false);
+        static const DecodeValues url_values(true);
+        return url ? url_values : standard_values;
+      }
+
+#ifdef SIMPLE_WEB_BASE64_X86
+      /// 0: scalar, 1: SSSE3, 2: AVX2
+      static int simd_level() noexcept {
+        static const int level = [] {
+          __builtin_cpu_init();
+          if(__builtin_cpu_supports("avx2"))
+            return 2;
+          if(__builtin_cpu_supports("ssse3"))
+            return 1;
+          return 0;
+        }();
+        return level;
+      }
+
+      // Encoding and decoding of 12 bytes per 128-bit lane, see http://0x80.pl/articles/index.html#base64-algorithm-new
+
+      /// Returns number of input bytes encoded, which is a multiple of 3.
+      __attribute__((target("ssse3"))) static std::size_t encode_ssse3(const unsigned char *input, std::size_t size, char *output, bool url) noexcept {
+        const auto shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+        const auto offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           url ? '-' - 62 : '+' - 62, url ? '_' - 63 : '/' - 63, 'A', 0, 0);
+        std::size_t i = 0;
+        // Loads 16 bytes, of which 12 are encoded
+        for(; i + 16 <= size; i += 12) {
+          auto in = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i)), shuffle);
+          auto indices = _mm_or_si128(_mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040)),
+                                      _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010)));
+          auto offset_indices = _mm_or_si128(_mm_subs_epu8(indices, _mm_set1_epi8(51)), _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+          auto out = _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, offset_indices));
+          _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i / 3 * 4), out);
+        }
+        return i;
+      }
+
+      /// Returns number of input bytes encoded, which is a multiple of 3.
+      __attribute__((target("avx2"))) static std::size_t encode_avx2(const unsigned char *input, std::size_t size, char *output, bool url) noexcept {
+        const auto shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                             10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+        const auto offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                              url ? '-' - 62 : '+' - 62, url ? '_' - 63 : '/' - 63, 'A', 0, 0,
+                                              'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                              url ? '-' - 62 : '+' - 62, url ? '_' - 63 : '/' - 63, 'A', 0, 0);
+        std::size_t i = 0;
+        // Loads 28 bytes, of which 24 are encoded
+        for(; i + 28 <= size; i += 24) {
+          auto in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i))),
+                                            _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i + 12)), 1);
+          in = _mm256_shuffle_epi8(in, shuffle);
+          auto indices = _mm256_or_si256(_mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040)),
+                                         _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010)));
+          auto offset_indices = _mm256_or_si256(_mm256_subs_epu8(indices, _mm256_set1_epi8(51)), _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+          auto out = _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, offset_indices));
+          _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i / 3 * 4), out);
+        }
+        return i;
+      }
+
+      /// Returns number of characters decoded, which is a multiple of 4.
+      /// Stops at the first block containing invalid characters, which are then reported by the scalar decoder.
+      __attribute__((target("ssse3"))) static std::size_t decode_ssse3(const char *base64, std::size_t size, unsigned char *output, bool url) noexcept {
+        const auto c62 = _mm_set1_epi8(url ? '-' : '+'), c63 = _mm_set1_epi8(url ? '_' : '/');
+        const auto shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        std::size_t i = 0;
+        // Decodes 16 characters to 12 bytes, but stores 16 bytes
+        for(; i + 24 <= size; i += 16) {
+          auto in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(base64 + i));
+          auto upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), in));
+          auto lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), in));
+          auto digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), in));
+          auto is_c62 = _mm_cmpeq_epi8(in, c62), is_c63 = _mm_cmpeq_epi8(in, c63);
+          if(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, is_c62)), is_c63)) != 0xffff)
+            break;
+          auto offset = _mm_or_si128(_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')), _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+                                     _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+                                                  _mm_or_si128(_mm_and_si128(is_c62, _mm_sub_epi8(_mm_set1_epi8(62), c62)), _mm_and_si128(is_c63, _mm_sub_epi8(_mm_set1_epi8(63), c63)))));
+          auto values = _mm_add_epi8(in, offset);
+          auto out = _mm_madd_epi16(_mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+          _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i / 4 * 3), _mm_shuffle_epi8(out, shuffle));
+        }
+        return i;
+      }
+
+      /// Returns number of characters decoded, which is a multiple of 4.
+      /// Stops at the first block containing invalid characters, which are then reported by the scalar decoder.
+      __attribute__((target("avx2"))) static std::size_t decode_avx2(const char *base64, std::size_t size, unsigned char *output, bool url) noexcept {
+        const auto c62 = _mm256_set1_epi8(url ? '-' : '+'), c63 = _mm256_set1_epi8(url ? '_' : '/');
+        const auto shuffle = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                              2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        const auto permute = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+        std::size_t i = 0;
+        // Decodes 32 characters to 24 bytes, but stores 32 bytes
+        for(; i + 44 <= size; i += 32) {
+          auto in = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(base64 + i));
+          auto upper = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), in));
+          auto lower = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), in));
+          auto digit = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+          auto is_c62 = _mm256_cmpeq_epi8(in, c62), is_c63 = _mm256_cmpeq_epi8(in, c63);
+          if(_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, is_c62)), is_c63)) != -1)
+            break;
+          auto offset = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')), _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a'))),
+                                        _mm256_or_si256(_mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')),
+                                                        _mm256_or_si256(_mm256_and_si256(is_c62, _mm256_sub_epi8(_mm256_set1_epi8(62), c62)), _mm256_and_si256(is_c63, _mm256_sub_epi8(_mm256_set1_epi8(63), c63)))));
+          auto values = _mm256_add_epi8(in, offset);
+          auto out = _mm256_madd_epi16(_mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+          out = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(out, shuffle), permute);
+          _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i / 4 * 3), out);
+        }
+        return i;
+      }
+#endif
+    };
+
   public:
+    /// Base64 encoding with padding, as described in RFC 4648 section 4.
     class Base64 {
     public:
+      /// Returns the number of characters in the encoding of size bytes.
+      static std::size_t encoded_size(std::size_t size) noexcept {
+        return Base64Codec::encoded_size(size, false);
+      }
+
+      /// Returns the number of bytes that valid base64 decodes to.
+      static std::size_t decoded_size(const char *base64, std::size_t size) noexcept {
+        return Base64Codec::decoded_size(base64, size);
+      }
+
+      /// Writes encoded_size(size) characters to output, and returns the number of characters written.
+      static std::size_t encode(const char *ascii, std::size_t size, char *output) noexcept {
+        return Base64Codec::encode(reinterpret_cast<const unsigned char *>(ascii), size, output, false);
+      }
+
+      /// Writes decoded_size(base64, size) bytes to output, and returns the number of bytes written.
+      /// Returns std::string::npos if base64 is not valid.
+      static std::size_t decode(const char *base64, std::size_t size, char *output) noexcept {
+        return Base64Codec::decode(base64, size, reinterpret_cast<unsigned char *>(output), false);
+      }
+
       static std::string encode(const std::string &ascii) noexcept {
         std::string base64;
+        base64.resize(encoded_size(ascii.size()));
+        encode(ascii.data(), ascii.size(), &base64[0]);
+        return base64;
+      }
 
-        BIO *bio, *b64;
-        BUF_MEM *bptr = BUF_MEM_new();
+      /// Returns empty string if base64 is not valid.
+      static std::string decode(const std::string &base64) noexcept {
+        std::string ascii;
+        ascii.resize(decoded_size(base64.data(), base64.size()));
+        if(decode(base64.data(), base64.size(), &ascii[0]) == std::string::npos)
+          ascii.clear();
+        return ascii;
+      }
 
-        b64 = BIO_new(BIO_f_base64());
-        BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
-        bio = BIO_new(BIO_s_mem());
-        BIO_push(b64, bio);
-        BIO_set_mem_buf(b64, bptr, BIO_CLOSE);
+      /// Incremental encoder for large input.
+      class Encoder : public Base64Codec::Encoder {
+      public:
+        Encoder() noexcept : Base64Codec::Encoder(false) {}
+      };
+
+      /// Incremental decoder for large input.
+      class Decoder : public Base64Codec::Decoder {
+      public:
+        Decoder() noexcept : Base64Codec::Decoder(false) {}
+      };
+    };
 
-        // Write directly to base64-buffer to avoid copy
-        auto base64_length = static_cast<std::size_t>(round(4 * ceil(static_cast<double>(ascii.size()) / 3.0)));
-        base64.resize(base64_length);
-        bptr->length = 0;
-        bptr->max = base64_length + 1;
-        bptr->data = &base64[0];
+    /// URL and filename safe base64 encoding without padding, as described in RFC 4648 section 5.
+    /// Decoding accepts input with or without padding.
+    class Base64Url {
+    public:
+      /// Returns the number of characters in the encoding of size bytes.
+      static std::size_t encoded_size(std::size_t size) noexcept {
+        return Base64Codec::encoded_size(size, true);
+      }
 
-        if(BIO_write(b64, &ascii[0], static_cast<int>(ascii.size())) <= 0 || BIO_flush(b64) <= 0)
-          base64.clear();
+      /// Returns the number of bytes that valid base64url decodes to.
+      static std::size_t decoded_size(const char *base64, std::size_t size) noexcept {
+        return Base64Codec::decoded_size(base64, size);
+      }
 
-        // To keep &base64[0] through BIO_free_all(b64)
-        bptr->length = 0;
-        bptr->max = 0;
-        bptr->data = nullptr;
+      /// Writes encoded_size(size) characters to output, and returns the number of characters written.
+      static std::size_t encode(const char *ascii, std::size_t size, char *output) noexcept {
+        return Base64Codec::encode(reinterpret_cast<const unsigned char *>(ascii), size, output, true);
+      }
 
-        BIO_free_all(b64);
+      /// Writes decoded_size(base64, size) bytes to output, and returns the number of bytes written.
+      /// Returns std::string::npos if base64 is not valid.
+      static std::size_t decode(const char *base64, std::size_t size, char *output) noexcept {
+        return Base64Codec::decode(base64, size, reinterpret_cast<unsigned char *>(output), true);
+      }
 
+      static std::string encode(const std::string &ascii) noexcept {
+        std::string base64;
+        base64.resize(encoded_size(ascii.size()));
+        encode(ascii.data(), ascii.size(), &base64[0]);
         return base64;
       }
 
+      /// Returns empty string if base64 is not valid.
       static std::string decode(const std::string &base64) noexcept {
         std::string ascii;
+        ascii.resize(decoded_size(base64.data(), base64.size()));
+        if(decode(base64.data(), base64.size(), &ascii[0]) == std::string::npos)
+          ascii.clear();
+        return ascii;
+      }
 
-        // Resize ascii, however, the size is a up to two bytes too large.
-        ascii.resize((6 * base64.size()) / 8);
-        BIO *b64, *bio;
+      /// Incremental encoder for large input.
+      class Encoder : public Base64Codec::Encoder {
+      public:
+        Encoder() noexcept : Base64Codec::Encoder(true) {}
+      };
+
+      /// Incremental decoder for large input.
+      class Decoder : public Base64Codec::Decoder {
+      public:
+        Decoder() noexcept : Base64Codec::Decoder(true) {}
+      };
+    };
 
-        b64 = BIO_new(BIO_f_base64());
-        BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
-// TODO: Remove in 2020
-#if OPENSSL_VERSION_NUMBER <= 0x1000115fL
-        bio = BIO_new_mem_buf((char *)&base64[0], static_cast<int>(base64.size()));
-#else
-        bio = BIO_new_mem_buf(&base64[0], static_cast<int>(base64.size()));
+    /// Incremental message digest using the OpenSSL EVP interface, which selects hardware accelerated implementations when available.
+    class Hash {
+    public:
+      enum class Algorithm { md5,
+                             sha1,
+                             sha256,
+                             sha512 };
+
+      Hash(Algorithm algorithm) noexcept : md(evp_md(algorithm)), context(new_md_context()) {
+        init();
+      }
+
+      Hash(Hash &&other) noexcept : md(other.md), context(other.context) {
+        other.context = nullptr;
+      }
+
+      Hash(const Hash &) = delete;
+      Hash &operator=(const Hash &) = delete;
+
+      ~Hash() noexcept {
+        if(context)
+          free_md_context(context);
+      }
+
+      /// Starts a new digest. Called by the constructor and final().
+      void init() noexcept {
+        EVP_DigestInit_ex(context, md, nullptr);
+      }
+
+      void update(const void *data, std::size_t size) noexcept {
+        EVP_DigestUpdate(context, data, size);
+      }
+
+      /// Updates with any buffer having data() and size(), for instance std::string, string_view, or
+      /// asio::const_buffer such as the buffers returned from asio::streambuf::data().
+      template <class Buffer>
+      auto update(const Buffer &buffer) noexcept -> decltype(buffer.data(), buffer.size(), void()) {
+        update(buffer.data(), buffer.size());
+      }
+
+      /// Reads and updates with the rest of the stream.
+      void update(std::istream &stream) noexcept {
+        auto buffer = read_buffer();
+        std::streamsize read_length;
+        while((read_length = stream.rdbuf()->sgetn(buffer, buffer_size)) > 0)
+          update(buffer, static_cast<std::size_t>(read_length));
+      }
+
+      /// Updates with the contents of the file at path. Regular files are memory mapped where supported, while for
+      /// instance empty files, which might be generated when read, and files that cannot be mapped are read as streams.
+      /// Returns false if the file could not be read.
+      bool update_file(const std::string &path) noexcept {
+#ifdef SIMPLE_WEB_CRYPTO_MMAP
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+          return false;
+        struct stat status;
+        bool status_read = fstat(fd, &status) == 0;
+        if(status_read && S_ISDIR(status.st_mode)) {
+          close(fd);
+          return false;
+        }
+        if(status_read && S_ISREG(status.st_mode) && status.st_size > 0 &&
+           static_cast<unsigned long long>(status.st_size) <= std::numeric_limits<std::size_t>::max()) {
+          auto size = static_cast<std::size_t>(status.st_size);
+          auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if(data != MAP_FAILED) {
+            madvise(data, size, MADV_SEQUENTIAL);
+            update(data, size);
+            munmap(data, size);
+            close(fd);
+            return true;
+          }
+        }
+        close(fd);
 #endif
-        bio = BIO_push(b64, bio);
+        std::ifstream stream(path, std::ios::binary);
+        if(!stream)
+          return false;
+        update(stream);
+        return !stream.bad();
+      }
+
+      /// Returns the digest, and starts a new digest.
+      std::string final() noexcept {
+        std::string hash;
+        hash.resize(static_cast<std::size_t>(EVP_MD_size(md)));
+        EVP_DigestFinal_ex(context, reinterpret_cast<unsigned char *>(&hash[0]), nullptr);
+        init();
+        return hash;
+      }
+
+      /// Returns the OpenSSL digest of the given algorithm.
+      static const EVP_MD *evp_md(Algorithm algorithm) noexcept {
+        switch(algorithm) {
+        case Algorithm::md5: return EVP_md5();
+        case Algorithm::sha1: return EVP_sha1();
+        case Algorithm::sha256: return EVP_sha256();
+        case Algorithm::sha512: return EVP_sha512();
+        }
+        return EVP_sha256();
+      }
 
-        auto decoded_length = BIO_read(bio, &ascii[0], static_cast<int>(ascii.size()));
-        if(decoded_length > 0)
-          ascii.resize(static_cast<std::size_t>(decoded_length));
+    private:
+      const EVP_MD *md;
+      EVP_MD_CTX *context;
+
+      /// Reused by each thread instead of allocating a buffer for every stream.
+      static char *read_buffer() noexcept {
+        thread_local std::vector<char> buffer(buffer_size);
+        return buffer.data();
+      }
+    };
+
+    /// HMAC where the inner and outer digest states of the key are computed once, and copied for each message.
+    /// sign() and verify() can be called from several threads at the same time.
+    class Hmac {
+    public:
+      Hmac(const std::string &key, Hash::Algorithm algorithm = Hash::Algorithm::sha256) noexcept
+          : md(Hash::evp_md(algorithm)), inner(new_md_context()), outer(new_md_context()) {
+        auto block_size = static_cast<std::size_t>(EVP_MD_block_size(md));
+        std::vector<unsigned char> block(block_size, 0);
+        if(key.size() > block_size) {
+          auto hash = digest(md, key.data(), key.size(), 1);
+          std::memcpy(block.data(), hash.data(), hash.size());
+        }
         else
-          ascii.clear();
+          std::memcpy(block.data(), key.data(), key.size());
 
-        BIO_free_all(b64);
+        for(auto &byte : block)
+          byte ^= 0x36;
+        EVP_DigestInit_ex(inner, md, nullptr);
+        EVP_DigestUpdate(inner, block.data(), block.size());
 
-        return ascii;
+        for(auto &byte : block)
+          byte ^= 0x36 ^ 0x5c;
+        EVP_DigestInit_ex(outer, md, nullptr);
+        EVP_DigestUpdate(outer, block.data(), block.size());
+
+        OPENSSL_cleanse(block.data(), block.size());
+      }
+
+      Hmac(Hmac &&other) noexcept : md(other.md), inner(other.inner), outer(other.outer) {
+        other.inner = nullptr;
+        other.outer = nullptr;
+      }
+
+      Hmac(const Hmac &) = delete;
+      Hmac &operator=(const Hmac &) = delete;
+
+      ~Hmac() noexcept {
+        if(inner)
+          free_md_context(inner);
+        if(outer)
+          free_md_context(outer);
+      }
+
+      /// Returns the number of bytes in a signature.
+      std::size_t size() const noexcept {
+        return static_cast<std::size_t>(EVP_MD_size(md));
+      }
+
+      std::string sign(const void *data, std::size_t size) const noexcept {
+        auto context = thread_md_context();
+        unsigned char inner_hash[EVP_MAX_MD_SIZE];
+        unsigned int inner_hash_size;
+        EVP_MD_CTX_copy_ex(context, inner);
+        EVP_DigestUpdate(context, data, size);
+        EVP_DigestFinal_ex(context, inner_hash, &inner_hash_size);
+
+        std::string signature;
+        signature.resize(this->size());
+        EVP_MD_CTX_copy_ex(context, outer);
+        EVP_DigestUpdate(context, inner_hash, inner_hash_size);
+        EVP_DigestFinal_ex(context, reinterpret_cast<unsigned char *>(&signature[0]), nullptr);
+        return signature;
       }
+
+      std::string sign(const std::string &message) const noexcept {
+        return sign(message.data(), message.size());
+      }
+
+      /// Compares the signature of the message with the given signature in constant time.
+      bool verify(const void *data, std::size_t size, const std::string &signature) const noexcept {
+        if(signature.size() != this->size())
+          return false;
+        auto expected_signature = sign(data, size);
+        return CRYPTO_memcmp(expected_signature.data(), signature.data(), signature.size()) == 0;
+      }
+
+      bool verify(const std::string &message, const std::string &signature) const noexcept {
+        return verify(message.data(), message.size(), signature);
+      }
+
+    private:
+      const EVP_MD *md;
+      EVP_MD_CTX *inner;
+      EVP_MD_CTX *outer;
     };
 
+    /// Returns the digests of the files at the given paths, in the same order, computed by the given number of threads.
+    /// The digest is empty for files that could not be read.
+    static std::vector<std::string> hash_files(const std::vector<std::string> &paths, Hash::Algorithm algorithm,
+                                               std::size_t threads = std::thread::hardware_concurrency()) {
+      std::vector<std::string> hashes(paths.size());
+      std::atomic<std::size_t> next(0);
+      auto hash_next = [&paths, &hashes, &next, algorithm] {
+        Hash hash(algorithm);
+        std::size_t index;
+        while((index = next++) < paths.size()) {
+          if(hash.update_file(paths[index]))
+            hashes[index] = hash.final();
+          else
+            hash.init();
+        }
+      };
+
+      threads = std::max<std::size_t>(1, std::min(threads, paths.size()));
+      std::vector<std::thread> thread_pool;
+      for(std::size_t c = 1; c < threads; ++c)
+        thread_pool.emplace_back(hash_next);
+      hash_next();
+      for(auto &thread : thread_pool)
+        thread.join();
+      return hashes;
+    }
+
     /// Return hex string from bytes in input string.
     static std::string to_hex_string(const std::string &input) noexcept {
       std::stringstream hex_stream;
@@ -98,119 +769,55 @@ namespace SimpleWeb {
     }
 
     static std::string md5(const std::string &input, std::size_t iterations = 1) noexcept {
-      std::string hash;
-
-      hash.resize(128 / 8);
-      MD5(reinterpret_cast<const unsigned char *>(&input[0]), input.size(), reinterpret_cast<unsigned char *>(&hash[0]));
-
-      for(std::size_t c = 1; c < iterations; ++c)
-        MD5(reinterpret_cast<const unsigned char *>(&hash[0]), hash.size(), reinterpret_cast<unsigned char *>(&hash[0]));
-
-      return hash;
+      return digest(EVP_md5(), input.data(), input.size(), iterations);
     }
 
     static std::string md5(std::istream &stream, std::size_t iterations = 1) noexcept {
-      MD5_CTX context;
-      MD5_Init(&context);
-      std::streamsize read_length;
-      std::vector<char> buffer(buffer_size);
-      while((read_length = stream.read(&buffer[0], buffer_size).gcount()) > 0)
-        MD5_Update(&context, buffer.data(), static_cast<std::size_t>(read_length));
-      std::string hash;
-      hash.resize(128 / 8);
-      MD5_Final(reinterpret_cast<unsigned char *>(&hash[0]), &context);
-
-      for(std::size_t c = 1; c < iterations; ++c)
-        MD5(reinterpret_cast<const unsigned char *>(&hash[0]), hash.size(), reinterpret_cast<unsigned char *>(&hash[0]));
-
-      return hash;
+      Hash context(Hash::Algorithm::md5);
+      context.update(stream);
+      auto hash = context.final();
+      if(iterations <= 1)
+        return hash;
+      return digest(EVP_md5(), hash.data(), hash.size(), iterations - 1);
     }
 
     static std::string sha1(const std::string &input, std::size_t iterations = 1) noexcept {
-      std::string hash;
-
-      hash.resize(160 / 8);
-      SHA1(reinterpret_cast<const unsigned char *>(&input[0]), input.size(), reinterpret_cast<unsigned char *>(&hash[0]));
-
-      for(std::size_t c = 1; c < iterations; ++c)
-        SHA1(reinterpret_cast<const unsigned char *>(&hash[0]), hash.size(), reinterpret_cast<unsigned char *>(&hash[0]));
-
-      return hash;
+      return digest(EVP_sha1(), input.data(), input.size(), iterations);
     }
 
     static std::string sha1(std::istream &stream, std::size_t iterations = 1) noexcept {
-      SHA_CTX context;
-      SHA1_Init(&context);
-      std::streamsize read_length;
-      std::vector<char> buffer(buffer_size);
-      while((read_length = stream.read(&buffer[0], buffer_size).gcount()) > 0)
-        SHA1_Update(&context, buffer.data(), static_cast<std::size_t>(read_length));
-      std::string hash;
-      hash.resize(160 / 8);
-      SHA1_Final(reinterpret_cast<unsigned char *>(&hash[0]), &context);
-
-      for(std::size_t c = 1; c < iterations; ++c)
-        SHA1(reinterpret_cast<const unsigned char *>(&hash[0]), hash.size(), reinterpret_cast<unsigned char *>(&hash[0]));
-
-      return hash;
+      Hash context(Hash::Algorithm::sha1);
+      context.update(stream);
+      auto hash = context.final();
+      if(iterations <= 1)
+        return hash;
+      return digest(EVP_sha1(), hash.data(), hash.size(), iterations - 1);
     }
 
     static std::string sha256(const std::string &input, std::size_t iterations = 1) noexcept {
-      std::string hash;
-
-      hash.resize(256 / 8);
-      SHA256(reinterpret_cast<const unsigned char *>(&input[0]), input.size(), reinterpret_cast<unsigned char *>(&hash[0]));
-
-      for(std::size_t c = 1; c < iterations; ++c)
-        SHA256(reinterpret_cast<const unsigned char *>(&hash[0]), hash.size(), reinterpret_cast<unsigned char *>(&hash[0]));
-
-      return hash;
+      return digest(EVP_sha256(), input.data(), input.size(), iterations);
     }
 
     static std::string sha256(std::istream &stream, std::size_t iterations = 1) noexcept {
-      SHA256_CTX context;
-      SHA256_Init(&context);
-      std::streamsize read_length;
-      std::vector<char> buffer(buffer_size);
-      while((read_length = stream.read(&buffer[0], buffer_size).gcount()) > 0)
-        SHA256_Update(&context, buffer.data(), static_cast<std::size_t>(read_length));
-      std::string hash;
-      hash.resize(256 / 8);
-      SHA256_Final(reinterpret_cast<unsigned char *>(&hash[0]), &context);
-
-      for(std::size_t c = 1; c < iterations; ++c)
-        SHA256(reinterpret_cast<const unsigned char *>(&hash[0]), hash.size(), reinterpret_cast<unsigned char *>(&hash[0]));
-
-      return hash;
+      Hash context(Hash::Algorithm::sha256);
+      context.update(stream);
+      auto hash = context.final();
+      if(iterations <= 1)
+        return hash;
+      return digest(EVP_sha256(), hash.data(), hash.size(), iterations - 1);
     }
 
     static std::string sha512(const std::string &input, std::size_t iterations = 1) noexcept {
-      std::string hash;
-
-      hash.resize(512 / 8);
-      SHA512(reinterpret_cast<const unsigned char *>(&input[0]), input.size(), reinterpret_cast<unsigned char *>(&hash[0]));
-
-      for(std::size_t c = 1; c < iterations; ++c)
-        SHA512(reinterpret_cast<const unsigned char *>(&hash[0]), hash.size(), reinterpret_cast<unsigned char *>(&hash[0]));
-
-      return hash;
+      return digest(EVP_sha512(), input.data(), input.size(), iterations);
     }
 
     static std::string sha512(std::istream &stream, std::size_t iterations = 1) noexcept {
-      SHA512_CTX context;
-      SHA512_Init(&context);
-      std::streamsize read_length;
-      std::vector<char> buffer(buffer_size);
-      while((read_length = stream.read(&buffer[0], buffer_size).gcount()) > 0)
-        SHA512_Update(&context, buffer.data(), static_cast<std::size_t>(read_length));
-      std::string hash;
-      hash.resize(512 / 8);
-      SHA512_Final(reinterpret_cast<unsigned char *>(&hash[0]), &context);
-
-      for(std::size_t c = 1; c < iterations; ++c)
-        SHA512(reinterpret_cast<const unsigned char *>(&hash[0]), hash.size(), reinterpret_cast<unsigned char *>(&hash[0]));
-
-      return hash;
+      Hash context(Hash::Algorithm::sha512);
+      context.update(stream);
+      auto hash = context.final();
+      if(iterations <= 1)
+        return hash;
+      return digest(EVP_sha512(), hash.data(), hash.size(), iterations - 1);
     }
 
     /// key_size is number of bytes of the returned key.
@@ -222,6 +829,127 @@ namespace SimpleWeb {
                              key_size, reinterpret_cast<unsigned char *>(&key[0]));
       return key;
     }
+
+    /// PBKDF2 with the given HMAC digest. key_size is number of bytes of the returned key.
+    static std::string pbkdf2(const std::string &password, const std::string &salt, int iterations, int key_size, Hash::Algorithm algorithm) noexcept {
+      std::string key;
+      key.resize(static_cast<std::size_t>(key_size));
+      PKCS5_PBKDF2_HMAC(password.c_str(), static_cast<int>(password.size()),
+                        reinterpret_cast<const unsigned char *>(salt.c_str()), static_cast<int>(salt.size()), iterations,
+                        Hash::evp_md(algorithm), key_size, reinterpret_cast<unsigned char *>(&key[0]));
+      return key;
+    }
+
+    /// Runs PBKDF2 on a dedicated thread pool, so that password hashing does not block the threads running io_service.
+    class Pbkdf2Service {
+    public:
+      class Statistics {
+      public:
+        /// Number of jobs waiting for a thread
+        std::size_t queued = 0;
+        /// Highest number of jobs waiting for a thread
+        std::size_t max_queued = 0;
+        /// Number of jobs being run
+        std::size_t running = 0;
+        std::size_t completed = 0;
+        /// Number of jobs not accepted because max_queued_jobs was reached
+        std::size_t rejected = 0;
+      };
+
+      /// max_queued_jobs: maximum number of jobs waiting for a thread, 0 for no limit.
+      Pbkdf2Service(std::size_t threads, std::size_t max_queued_jobs = 0) : max_queued_jobs(max_queued_jobs) {
+        for(std::size_t c = 0; c < threads; ++c)
+          thread_pool.emplace_back([this] { run(); });
+      }
+
+      /// Waits for running jobs to complete. Jobs that have not been started are discarded without calling their callbacks.
+      ~Pbkdf2Service() noexcept {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          stopped = true;
+          jobs.clear();
+        }
+        condition_variable.notify_all();
+        for(auto &thread : thread_pool)
+          thread.join();
+      }
+
+      /// Computes the key, and calls callback(key) through io_service.post(), for instance in the io_service of a server.
+      /// Returns false, without calling callback, if max_queued_jobs was reached.
+      template <class IoService>
+      bool pbkdf2(IoService &io_service, std::string password, std::string salt, int iterations, int key_size, Hash::Algorithm algorithm,
+                  std::function<void(std::string key)> callback) {
+        auto io_service_ptr = &io_service;
+        return add_job([io_service_ptr, password, salt, iterations, key_size, algorithm, callback] {
+          auto key = Crypto::pbkdf2(password, salt, iterations, key_size, algorithm);
+          io_service_ptr->post([callback, key] {
+            callback(key);
+          });
+        });
+      }
+
+      /// Computes the key, compares it with expected_key in constant time, and calls callback(verified) through io_service.post().
+      /// Returns false, without calling callback, if max_queued_jobs was reached.
+      template <class IoService>
+      bool verify(IoService &io_service, std::string password, std::string salt, int iterations, Hash::Algorithm algorithm, std::string expected_key,
+                  std::function<void(bool verified)> callback) {
+        auto io_service_ptr = &io_service;
+        return add_job([io_service_ptr, password, salt, iterations, algorithm, expected_key, callback] {
+          auto key = Crypto::pbkdf2(password, salt, iterations, static_cast<int>(expected_key.size()), algorithm);
+          bool verified = !expected_key.empty() && CRYPTO_memcmp(key.data(), expected_key.data(), key.size()) == 0;
+          io_service_ptr->post([callback, verified] {
+            callback(verified);
+          });
+        });
+      }
+
+      Statistics statistics() noexcept {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto result = stats;
+        result.queued = jobs.size();
+        return result;
+      }
+
+    private:
+      std::size_t max_queued_jobs;
+      std::vector<std::thread> thread_pool;
+      std::deque<std::function<void()>> jobs;
+      Statistics stats;
+      bool stopped = false;
+      std::mutex mutex;
+      std::condition_variable condition_variable;
+
+      bool add_job(std::function<void()> &&job) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          if(max_queued_jobs > 0 && jobs.size() >= max_queued_jobs) {
+            ++stats.rejected;
+            return false;
+          }
+          jobs.emplace_back(std::move(job));
+          stats.max_queued = std::max(stats.max_queued, jobs.size());
+        }
+        condition_variable.notify_one();
+        return true;
+      }
+
+      void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true) {
+          condition_variable.wait(lock, [this] { return stopped || !jobs.empty(); });
+          if(stopped)
+            return;
+          auto job = std::move(jobs.front());
+          jobs.pop_front();
+          ++stats.running;
+          lock.unlock();
+          job();
+          lock.lock();
+          --stats.running;
+          ++stats.completed;
+        }
+      }
+    };
   };
 }
 #endif /* SIMPLE_WEB_CRYPTO_HPP */
@@ -10,6 +10,9 @@
 #include <sstream>
 #include <thread>
 #include <unordered_set>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 #ifdef USE_STANDALONE_ASIO
 #include <asio.hpp>
@@ -57,12 +60,13 @@ namespace SimpleWeb {
       friend class ServerBase<socket_type>;
       friend class Server<socket_type>;
 
-      asio::streambuf streambuf;
+      asio::basic_streambuf<ArenaAllocator<char>> streambuf;
 
       std::shared_ptr<Session> session;
       long timeout_content;
 
-      Response(std::shared_ptr<Session> session, long timeout_content) noexcept : std::ostream(&streambuf), session(std::move(session)), timeout_content(timeout_content) {}
+      Response(std::shared_ptr<Session> session, long timeout_content) noexcept
+          : std::ostream(&streambuf), streambuf(std::numeric_limits<std::size_t>::max(), ArenaAllocator<char>(session->connection->arena)), session(std::move(session)), timeout_content(timeout_content) {}
 
       template <typename size_type>
       void write_header(const CaseInsensitiveMultimap &header, size_type size) {
@@ -74,12 +78,16 @@ namespace SimpleWeb {
           else if(!chunked_transfer_encoding && case_insensitive_equal(field.first, "transfer-encoding") && case_insensitive_equal(field.second, "chunked"))
             chunked_transfer_encoding = true;
 
-          *this << field.first << ": " << field.second << "\r\n";
+          append(field.first).append(": ", 2).append(field.second).append("\r\n", 2);
         }
         if(!content_length_written && !chunked_transfer_encoding && !close_connection_after_response)
-          *this << "Content-Length: " << size << "\r\n\r\n";
+          append("Content-Length: ", 16).append(size).append("\r\n\r\n", 4);
         else
-          *this << "\r\n";
+          append("\r\n", 2);
+      }
+
+      void write_status_line(StatusCode status_code) {
+        append("HTTP/1.1 ", 9).append(SimpleWeb::status_code(status_code)).append("\r\n", 2);
       }
 
     public:
@@ -87,18 +95,55 @@ namespace SimpleWeb {
         return streambuf.size();
       }
 
+      /// Reserve space in the stream buffer for at least the given number of additional bytes,
+      /// so that the following writes do not reallocate.
+      void reserve(std::size_t size) {
+        streambuf.prepare(size);
+      }
+
+      /// Append bytes directly to the stream buffer, bypassing std::ostream formatting.
+      /// Can be mixed with the std::ostream interface.
+      Response &append(const char *data, std::size_t size) {
+        streambuf.commit(asio::buffer_copy(streambuf.prepare(size), asio::buffer(data, size)));
+        return *this;
+      }
+
+      /// Append string directly to the stream buffer, bypassing std::ostream formatting.
+      Response &append(string_view str) {
+        return append(str.data(), str.size());
+      }
+
+      /// Append character directly to the stream buffer, bypassing std::ostream formatting.
+      Response &append(char chr) {
+        return append(&chr, 1);
+      }
+
+      /// Append integer in base 10 directly to the stream buffer, bypassing std::ostream formatting and locale.
+      template <typename integer_type>
+      typename std::enable_if<std::is_integral<integer_type>::value, Response &>::type append(integer_type value) {
+        streambuf.commit(ToChars::integer(asio::buffer_cast<char *>(streambuf.prepare(ToChars::max_integer_size)), value));
+        return *this;
+      }
+
+      /// Append floating point number in fixed notation with the given number of decimals directly to the stream buffer,
+      /// bypassing std::ostream formatting and locale.
+      Response &append(double value, unsigned precision = 6) {
+        streambuf.commit(ToChars::decimal(asio::buffer_cast<char *>(streambuf.prepare(ToChars::max_decimal_size)), value, precision));
+        return *this;
+      }
+
       /// Use this function if you need to recursively send parts of a longer message
       void send(const std::function<void(const error_code &)> &callback = nullptr) noexcept {
         session->connection->set_timeout(timeout_content);
         auto self = this->shared_from_this(); // Keep Response instance alive through the following async_write
-        asio::async_write(*session->connection->socket, streambuf, [self, callback](const error_code &ec, std::size_t /*bytes_transferred*/) {
+        asio::async_write(*session->connection->socket, streambuf, make_memory_handler(session->connection, [self, callback](const error_code &ec, std::size_t /*bytes_transferred*/) {
           self->session->connection->cancel_timeout();
           auto lock = self->session->connection->handler_runner->continue_lock();
           if(!lock)
             return;
           if(callback)
             callback(ec);
-        });
+        }));
       }
 
       /// Write directly to stream buffer using std::ostream::write
@@ -108,25 +153,26 @@ namespace SimpleWeb {
 
       /// Convenience function for writing status line, potential header fields, and empty content
       void write(StatusCode status_code = StatusCode::success_ok, const CaseInsensitiveMultimap &header = CaseInsensitiveMultimap()) {
-        *this << "HTTP/1.1 " << SimpleWeb::status_code(status_code) << "\r\n";
+        write_status_line(status_code);
         write_header(header, 0);
       }
 
       /// Convenience function for writing status line, header fields, and content
       void write(StatusCode status_code, const std::string &content, const CaseInsensitiveMultimap &header = CaseInsensitiveMultimap()) {
-        *this << "HTTP/1.1 " << SimpleWeb::status_code(status_code) << "\r\n";
+        reserve(content.size() + 128); // Content and an estimate of the status line and header fields
+        write_status_line(status_code);
         write_header(header, content.size());
         if(!content.empty())
-          *this << content;
+          append(content);
       }
 
       /// Convenience function for writing status line, header fields, and content
       void write(StatusCode status_code, std::istream &content, const CaseInsensitiveMultimap &header = CaseInsensitiveMultimap()) {
-        *this << "HTTP/1.1 " << SimpleWeb::status_code(status_code) << "\r\n";
+        write_status_line(status_code);
         content.seekg(0, std::ios::end);
         auto size = content.tellg();
         content.seekg(0, std::ios::beg);
-        write_header(header, size);
+        write_header(header, static_cast<std::streamoff>(size));
         if(size)
           *this << content.rdbuf();
       }
@@ -157,14 +203,15 @@ namespace SimpleWeb {
       friend class ServerBase<socket_type>;
 
     public:
+      /// Returns the number of bytes that have not yet been read.
       std::size_t size() noexcept {
-        return streambuf.size();
+        return file_streambuf ? file_streambuf->size() : streambuf.size();
       }
       /// Convenience function to return std::string. The stream buffer is consumed.
       std::string string() noexcept {
         try {
           std::string str;
-          auto size = streambuf.size();
+          auto size = this->size();
           str.resize(size);
           read(&str[0], static_cast<std::streamsize>(size));
           return str;
@@ -174,9 +221,52 @@ namespace SimpleWeb {
         }
       }
 
+      /// Returns the temporary file holding the content, or nullptr if the content is kept in memory, see Config::content_file_threshold.
+      /// The file is removed when it is closed. Reading from the file directly will interfere with reading from this stream.
+      std::shared_ptr<std::FILE> file() const noexcept {
+        return file_;
+      }
+
+      /// Returns the file descriptor of the temporary file holding the content, or -1 if the content is kept in memory.
+      int fd() const noexcept {
+        if(!file_)
+          return -1;
+#ifdef _WIN32
+        return _fileno(file_.get());
+#else
+        return fileno(file_.get());
+#endif
+      }
+
+#ifndef _WIN32
+      /// Maps the whole content of the temporary file into memory. Returns nullptr if the content is kept in memory, or on failure.
+      /// The mapping is independent of the read position of this stream, and is removed when the returned pointer is released.
+      std::shared_ptr<const char> map() const noexcept {
+        if(!file_ || file_size == 0)
+          return nullptr;
+        auto size = file_size;
+        auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd(), 0);
+        if(data == MAP_FAILED)
+          return nullptr;
+        try {
+          return std::shared_ptr<const char>(static_cast<const char *>(data), [size](const char *data) {
+            munmap(const_cast<char *>(data), size);
+          });
+        }
+        catch(...) {
+          munmap(data, size);
+          return nullptr;
+        }
+      }
+#endif
+
     private:
-      asio::streambuf &streambuf;
-      Content(asio::streambuf &streambuf) noexcept : std::istream(&streambuf), streambuf(streambuf) {}
+      asio::basic_streambuf<ArenaAllocator<char>> &streambuf;
+      Content(asio::basic_streambuf<ArenaAllocator<char>> &streambuf) noexcept : std::istream(&streambuf), streambuf(streambuf) {}
+
+      std::shared_ptr<std::FILE> file_;
+      std::size_t file_size = 0;
+      std::unique_ptr<FileStreambuf> file_streambuf;
     };
 
     class Request {
@@ -184,10 +274,10 @@ namespace SimpleWeb {
       friend class Server<socket_type>;
       friend class Session;
 
-      asio::streambuf streambuf;
+      asio::basic_streambuf<ArenaAllocator<char>> streambuf;
 
-      Request(std::size_t max_request_streambuf_size, std::shared_ptr<asio::ip::tcp::endpoint> remote_endpoint) noexcept
-          : streambuf(max_request_streambuf_size), content(streambuf), remote_endpoint(std::move(remote_endpoint)) {}
+      Request(std::size_t max_request_streambuf_size, std::shared_ptr<asio::ip::tcp::endpoint> remote_endpoint, std::shared_ptr<Arena> arena = nullptr) noexcept
+          : streambuf(max_request_streambuf_size, ArenaAllocator<char>(std::move(arena))), content(streambuf), remote_endpoint(std::move(remote_endpoint)) {}
 
     public:
       std::string method, path, query_string, http_version;
@@ -198,6 +288,10 @@ namespace SimpleWeb {
 
       regex::smatch path_match;
 
+      /// The parts of multipart/form-data content that was parsed as it was received, see Config::parse_multipart.
+      /// The content is then not stored in Request::content.
+      std::shared_ptr<MultipartParser> multipart;
+
       std::shared_ptr<asio::ip::tcp::endpoint> remote_endpoint;
 
       /// The time point when the request header was fully read.
@@ -220,6 +314,12 @@ namespace SimpleWeb {
       CaseInsensitiveMultimap parse_query_string() noexcept {
         return SimpleWeb::QueryString::parse(query_string);
       }
+
+      /// Returns a view of the query string where only the values that are looked up are percent-decoded.
+      /// The view is valid as long as this request.
+      SimpleWeb::QueryString::View query_string_view() const noexcept {
+        return SimpleWeb::QueryString::View(query_string);
+      }
     };
 
   protected:
@@ -235,8 +335,17 @@ namespace SimpleWeb {
 
       std::unique_ptr<asio::steady_timer> timer;
 
+      /// Memory for the handlers of the asynchronous operations on this connection
+      HandlerMemory handler_memory;
+
+      /// Memory for the session, request and response objects of the current request on this connection
+      std::shared_ptr<Arena> arena;
+
       std::shared_ptr<asio::ip::tcp::endpoint> remote_endpoint;
 
+      /// Data received after the previous request, that is, the start of requests sent by a pipelining client
+      std::string pipelined_data;
+
       void close() noexcept {
         error_code ec;
         std::unique_lock<std::mutex> lock(socket_close_mutex); // The following operations seems to be needed to run sequentially
@@ -250,13 +359,15 @@ namespace SimpleWeb {
           return;
         }
 
-        timer = std::unique_ptr<asio::steady_timer>(new asio::steady_timer(socket->get_io_service()));
+        // Reuse the timer of the previous timeout, if any, where expires_from_now() cancels the previous wait
+        if(!timer)
+          timer = std::unique_ptr<asio::steady_timer>(new asio::steady_timer(socket->get_io_service()));
         timer->expires_from_now(std::chrono::seconds(seconds));
         auto self = this->shared_from_this();
-        timer->async_wait([self](const error_code &ec) {
+        timer->async_wait(make_memory_handler(self, [self](const error_code &ec) {
           if(!ec)
             self->close();
-        });
+        }));
       }
 
       void cancel_timeout() noexcept {
@@ -274,7 +385,9 @@ namespace SimpleWeb {
           error_code ec;
           this->connection->remote_endpoint = std::make_shared<asio::ip::tcp::endpoint>(this->connection->socket->lowest_layer().remote_endpoint(ec));
         }
-        request = std::shared_ptr<Request>(new Request(max_request_streambuf_size, this->connection->remote_endpoint));
+        auto &arena = this->connection->arena;
+        request = std::shared_ptr<Request>(new(arena->allocate(sizeof(Request), alignof(Request))) Request(max_request_streambuf_size, this->connection->remote_endpoint, arena),
+                                           ArenaDeleter<Request>(arena), ArenaAllocator<Request>(arena));
       }
 
       std::shared_ptr<Connection> connection;
@@ -300,6 +413,29 @@ namespace SimpleWeb {
       /// Maximum size of request stream buffer. Defaults to architecture maximum.
       /// Reaching this limit will result in a message_size error code.
       std::size_t max_request_streambuf_size = std::numeric_limits<std::size_t>::max();
+      /// Size of the memory arena of each connection, from which the request, response and their stream buffers are allocated
+      /// while they fit. The arena is reused for the next request on the connection once these objects have been released.
+      /// Defaults to 8192 bytes. Set to 0 to allocate them with operator new.
+      std::size_t request_arena_size = 8192;
+      /// Parse multipart/form-data content with a Content-Length header field while it is received, instead of storing it
+      /// in Request::content. The parts are then found in Request::multipart. Defaults to false.
+      bool parse_multipart = false;
+      /// Multipart parts larger than this are written to temporary files instead of being kept in memory. Defaults to 64 KiB.
+      std::size_t multipart_memory_limit = 64 * 1024;
+      /// Once the multipart parts kept in memory would exceed this size in total, further part content is written to temporary files.
+      /// Defaults to 1 MiB.
+      std::size_t multipart_total_memory_limit = 1024 * 1024;
+      /// Maximum number of multipart parts. Reaching this limit will result in a message_size error code. Defaults to 1000.
+      std::size_t max_multipart_parts = 1000;
+      /// Maximum size of a multipart part. Reaching this limit will result in a message_size error code.
+      /// Defaults to architecture maximum.
+      std::size_t max_multipart_part_size = std::numeric_limits<std::size_t>::max();
+      /// Request content larger than this is written to a temporary file while it is received, instead of being kept in memory.
+      /// Request::content then reads from the file. Defaults to architecture maximum, that is, content is always kept in memory.
+      std::size_t content_file_threshold = std::numeric_limits<std::size_t>::max();
+      /// Maximum size of request content written to a temporary file, since such content is not limited by max_request_streambuf_size.
+      /// Reaching this limit will result in a message_size error code. Defaults to architecture maximum.
+      std::size_t max_content_file_size = std::numeric_limits<std::size_t>::max();
       /// IPv4 address in dotted decimal form or IPv6 address in hexadecimal notation.
       /// If empty, the address will be any address.
       std::string address;
@@ -447,6 +583,7 @@ namespace SimpleWeb {
         }
         delete connection;
       });
+      connection->arena = std::make_shared<Arena>(config.request_arena_size);
       {
         std::unique_lock<std::mutex> lock(*connections_mutex);
         connections->emplace(connection.get());
@@ -454,9 +591,21 @@ namespace SimpleWeb {
       return connection;
     }
 
+    /// Creates a session for the next request on the given connection, allocated from the arena of the connection.
+    std::shared_ptr<Session> create_session(const std::shared_ptr<Connection> &connection) noexcept {
+      connection->arena->next();
+      return std::allocate_shared<Session>(ArenaAllocator<Session>(connection->arena), config.max_request_streambuf_size, connection);
+    }
+
     void read(const std::shared_ptr<Session> &session) {
+      if(!session->connection->pipelined_data.empty()) {
+        auto &streambuf = session->request->streambuf;
+        streambuf.commit(asio::buffer_copy(streambuf.prepare(session->connection->pipelined_data.size()), asio::buffer(session->connection->pipelined_data)));
+        session->connection->pipelined_data.clear();
+      }
+
       session->connection->set_timeout(config.timeout_request);
-      asio::async_read_until(*session->connection->socket, session->request->streambuf, "\r\n\r\n", [this, session](const error_code &ec, std::size_t bytes_transferred) {
+      asio::async_read_until(*session->connection->socket, session->request->streambuf, "\r\n\r\n", make_memory_handler(session->connection, [this, session](const error_code &ec, std::size_t bytes_transferred) {
         session->connection->cancel_timeout();
         auto lock = session->connection->handler_runner->continue_lock();
         if(!lock)
@@ -496,9 +645,27 @@ namespace SimpleWeb {
                 this->on_error(session->request, make_error_code::make_error_code(errc::protocol_error));
               return;
             }
-            if(content_length > num_additional_bytes) {
+            std::string boundary;
+            if(config.parse_multipart && (header_it = session->request->header.find("Content-Type")) != session->request->header.end() &&
+               !(boundary = MultipartParser::boundary(header_it->second)).empty()) {
+              session->request->multipart = std::make_shared<MultipartParser>(boundary, config.multipart_memory_limit, config.max_multipart_part_size, 8 * 1024,
+                                                                            config.multipart_total_memory_limit, config.max_multipart_parts);
+              this->read_multipart(session, content_length);
+            }
+            else if(content_length > config.content_file_threshold) {
+              if(content_length > config.max_content_file_size) {
+                auto response = std::shared_ptr<Response>(new Response(session, this->config.timeout_content));
+                response->write(StatusCode::client_error_payload_too_large);
+                response->send();
+                if(this->on_error)
+                  this->on_error(session->request, make_error_code::make_error_code(errc::message_size));
+                return;
+              }
+              this->read_content_file(session, content_length);
+            }
+            else if(content_length > num_additional_bytes) {
               session->connection->set_timeout(config.timeout_content);
-              asio::async_read(*session->connection->socket, session->request->streambuf, asio::transfer_exactly(content_length - num_additional_bytes), [this, session](const error_code &ec, std::size_t /*bytes_transferred*/) {
+              asio::async_read(*session->connection->socket, session->request->streambuf, asio::transfer_exactly(content_length - num_additional_bytes), make_memory_handler(session->connection, [this, session](const error_code &ec, std::size_t /*bytes_transferred*/) {
                 session->connection->cancel_timeout();
                 auto lock = session->connection->handler_runner->continue_lock();
                 if(!lock)
@@ -516,92 +683,183 @@ namespace SimpleWeb {
                 }
                 else if(this->on_error)
                   this->on_error(session->request, ec);
-              });
+              }));
             }
-            else
+            else {
+              this->save_pipelined_data(session, static_cast<std::size_t>(content_length));
               this->find_resource(session);
+            }
           }
           else if((header_it = session->request->header.find("Transfer-Encoding")) != session->request->header.end() && header_it->second == "chunked") {
-            auto chunks_streambuf = std::make_shared<asio::streambuf>(this->config.max_request_streambuf_size);
-            this->read_chunked_transfer_encoded(session, chunks_streambuf);
+            auto decoder = std::allocate_shared<ChunkedDecoder>(ArenaAllocator<ChunkedDecoder>(session->connection->arena));
+            // The content received with the header is moved to the put area, where it is decoded
+            auto &streambuf = session->request->streambuf;
+            std::string received(asio::buffer_cast<const char *>(streambuf.data()), streambuf.size());
+            streambuf.consume(streambuf.size());
+            auto data = asio::buffer_cast<char *>(streambuf.prepare(received.size()));
+            std::memcpy(data, received.data(), received.size());
+            this->decode_chunked_transfer_encoded(session, decoder, data, received.size());
           }
-          else
+          else {
+            this->save_pipelined_data(session, 0);
             this->find_resource(session);
+          }
         }
         else if(this->on_error)
           this->on_error(session->request, ec);
-      });
+      }));
     }
 
-    void read_chunked_transfer_encoded(const std::shared_ptr<Session> &session, const std::shared_ptr<asio::streambuf> &chunks_streambuf) {
-      session->connection->set_timeout(config.timeout_content);
-      asio::async_read_until(*session->connection->socket, session->request->streambuf, "\r\n", [this, session, chunks_streambuf](const error_code &ec, size_t bytes_transferred) {
-        session->connection->cancel_timeout();
-        auto lock = session->connection->handler_runner->continue_lock();
-        if(!lock)
-          return;
-        if((!ec || ec == asio::error::not_found) && session->request->streambuf.size() == session->request->streambuf.max_size()) {
+    /// Passes the content in the request stream buffer to the multipart parser of the request, and reads the rest of the
+    /// content in pieces that are passed on as they are received.
+    void read_multipart(const std::shared_ptr<Session> &session, unsigned long long remaining) {
+      auto &streambuf = session->request->streambuf;
+      auto size = static_cast<std::size_t>(std::min<unsigned long long>(streambuf.size(), remaining));
+      auto &multipart = *session->request->multipart;
+      if(!multipart.write(asio::buffer_cast<const char *>(streambuf.data()), size)) {
+        if(multipart.error() == MultipartParser::Error::part_too_large || multipart.error() == MultipartParser::Error::too_many_parts) {
           auto response = std::shared_ptr<Response>(new Response(session, this->config.timeout_content));
           response->write(StatusCode::client_error_payload_too_large);
           response->send();
           if(this->on_error)
             this->on_error(session->request, make_error_code::make_error_code(errc::message_size));
+        }
+        else if(this->on_error)
+          this->on_error(session->request, make_error_code::make_error_code(multipart.error() == MultipartParser::Error::malformed ? errc::protocol_error : errc::io_error));
+        return;
+      }
+      streambuf.consume(size);
+      remaining -= size;
+
+      if(remaining == 0) {
+        if(!multipart.finished()) {
+          if(this->on_error)
+            this->on_error(session->request, make_error_code::make_error_code(errc::protocol_error));
           return;
         }
-        if(!ec) {
-          std::string line;
-          getline(session->request->content, line);
-          bytes_transferred -= line.size() + 1;
-          line.pop_back();
-          unsigned long length = 0;
-          try {
-            length = stoul(line, 0, 16);
-          }
-          catch(...) {
-            if(this->on_error)
-              this->on_error(session->request, make_error_code::make_error_code(errc::protocol_error));
-            return;
-          }
+        this->save_pipelined_data(session, 0);
+        this->find_resource(session);
+        return;
+      }
 
-          auto num_additional_bytes = session->request->streambuf.size() - bytes_transferred;
+      session->connection->set_timeout(config.timeout_content);
+      asio::async_read(*session->connection->socket, streambuf, asio::transfer_exactly(static_cast<std::size_t>(std::min<unsigned long long>(remaining, 64 * 1024))), make_memory_handler(session->connection, [this, session, remaining](const error_code &ec, std::size_t /*bytes_transferred*/) {
+        session->connection->cancel_timeout();
+        auto lock = session->connection->handler_runner->continue_lock();
+        if(!lock)
+          return;
+        if(!ec)
+          this->read_multipart(session, remaining);
+        else if(this->on_error)
+          this->on_error(session->request, ec);
+      }));
+    }
 
-          if((2 + length) > num_additional_bytes) {
-            session->connection->set_timeout(config.timeout_content);
-            asio::async_read(*session->connection->socket, session->request->streambuf, asio::transfer_exactly(2 + length - num_additional_bytes), [this, session, chunks_streambuf, length](const error_code &ec, size_t /*bytes_transferred*/) {
-              session->connection->cancel_timeout();
-              auto lock = session->connection->handler_runner->continue_lock();
-              if(!lock)
-                return;
-              if(!ec) {
-                if(session->request->streambuf.size() == session->request->streambuf.max_size()) {
-                  auto response = std::shared_ptr<Response>(new Response(session, this->config.timeout_content));
-                  response->write(StatusCode::client_error_payload_too_large);
-                  response->send();
-                  if(this->on_error)
-                    this->on_error(session->request, make_error_code::make_error_code(errc::message_size));
-                  return;
-                }
-                this->read_chunked_transfer_encoded_chunk(session, chunks_streambuf, length);
-              }
-              else if(this->on_error)
-                this->on_error(session->request, ec);
-            });
-          }
-          else
-            this->read_chunked_transfer_encoded_chunk(session, chunks_streambuf, length);
+    /// Writes the content in the request stream buffer to a temporary file, and reads the rest of the content in pieces that are
+    /// written as they are received.
+    void read_content_file(const std::shared_ptr<Session> &session, unsigned long long remaining) {
+      auto &streambuf = session->request->streambuf;
+      auto size = static_cast<std::size_t>(std::min<unsigned long long>(streambuf.size(), remaining));
+      if(!this->write_content_file(session, size))
+        return;
+      remaining -= size;
+
+      if(remaining == 0) {
+        if(this->open_content_file(session)) {
+          this->save_pipelined_data(session, 0);
+          this->find_resource(session);
         }
+        return;
+      }
+
+      session->connection->set_timeout(config.timeout_content);
+      asio::async_read(*session->connection->socket, streambuf, asio::transfer_exactly(static_cast<std::size_t>(std::min<unsigned long long>(remaining, 64 * 1024))), make_memory_handler(session->connection, [this, session, remaining](const error_code &ec, std::size_t /*bytes_transferred*/) {
+        session->connection->cancel_timeout();
+        auto lock = session->connection->handler_runner->continue_lock();
+        if(!lock)
+          return;
+        if(!ec)
+          this->read_content_file(session, remaining);
         else if(this->on_error)
           this->on_error(session->request, ec);
-      });
+      }));
+    }
+
+    /// Moves the first size bytes of the request stream buffer to the temporary content file, which is created if needed.
+    bool write_content_file(const std::shared_ptr<Session> &session, std::size_t size) {
+      auto &content = session->request->content;
+      auto &streambuf = session->request->streambuf;
+      if(!content.file_) {
+        auto file = std::tmpfile();
+        if(file)
+          content.file_ = std::shared_ptr<std::FILE>(file, std::fclose);
+      }
+      if(!content.file_ || std::fwrite(asio::buffer_cast<const char *>(streambuf.data()), 1, size, content.file_.get()) != size) {
+        if(this->on_error)
+          this->on_error(session->request, make_error_code::make_error_code(errc::io_error));
+        return false;
+      }
+      streambuf.consume(size);
+      content.file_size += size;
+      return true;
+    }
+
+    /// Makes Request::content read from the start of the temporary content file.
+    bool open_content_file(const std::shared_ptr<Session> &session) {
+      auto &content = session->request->content;
+      if(std::fflush(content.file_.get()) != 0 || std::fseek(content.file_.get(), 0, SEEK_SET) != 0) {
+        if(this->on_error)
+          this->on_error(session->request, make_error_code::make_error_code(errc::io_error));
+        return false;
+      }
+      content.file_streambuf = std::unique_ptr<FileStreambuf>(new FileStreambuf(content.file_, content.file_size));
+      content.rdbuf(content.file_streambuf.get());
+      return true;
     }
 
-    void read_chunked_transfer_encoded_chunk(const std::shared_ptr<Session> &session, const std::shared_ptr<asio::streambuf> &chunks_streambuf, unsigned long length) {
-      std::ostream tmp_stream(chunks_streambuf.get());
-      if(length > 0) {
-        std::unique_ptr<char[]> buffer(new char[length]);
-        session->request->content.read(buffer.get(), static_cast<std::streamsize>(length));
-        tmp_stream.write(buffer.get(), static_cast<std::streamsize>(length));
-        if(chunks_streambuf->size() == chunks_streambuf->max_size()) {
+    /// Reads chunked transfer encoded content into the put area of the request stream buffer, where it is decoded in place.
+    void read_chunked_transfer_encoded(const std::shared_ptr<Session> &session, const std::shared_ptr<ChunkedDecoder> &decoder) {
+      auto &streambuf = session->request->streambuf;
+      if(streambuf.size() == streambuf.max_size()) {
+        auto response = std::shared_ptr<Response>(new Response(session, this->config.timeout_content));
+        response->write(StatusCode::client_error_payload_too_large);
+        response->send();
+        if(this->on_error)
+          this->on_error(session->request, make_error_code::make_error_code(errc::message_size));
+        return;
+      }
+      // Read sizes grow with the content, from 512 bytes up to 64 KiB
+      auto read_size = session->request->content.file_ ? 65536 : std::min<std::size_t>(std::max<std::size_t>(512, streambuf.size()), 65536);
+      auto buffer = streambuf.prepare(std::min(read_size, streambuf.max_size() - streambuf.size()));
+      session->connection->set_timeout(config.timeout_content);
+      session->connection->socket->async_read_some(buffer, make_memory_handler(session->connection, [this, session, decoder, buffer](const error_code &ec, std::size_t bytes_transferred) {
+        session->connection->cancel_timeout();
+        auto lock = session->connection->handler_runner->continue_lock();
+        if(!lock)
+          return;
+        if(!ec)
+          this->decode_chunked_transfer_encoded(session, decoder, asio::buffer_cast<char *>(buffer), bytes_transferred);
+        else if(this->on_error)
+          this->on_error(session->request, ec);
+      }));
+    }
+
+    /// Decodes the given bytes, placed at the start of the put area of the request stream buffer, and commits the decoded content.
+    void decode_chunked_transfer_encoded(const std::shared_ptr<Session> &session, const std::shared_ptr<ChunkedDecoder> &decoder, char *data, std::size_t size) {
+      std::size_t consumed;
+      auto &streambuf = session->request->streambuf;
+      streambuf.commit(decoder->decode(data, size, data, consumed));
+      if(decoder->error() != ChunkedDecoder::Error::none) {
+        if(this->on_error)
+          this->on_error(session->request, make_error_code::make_error_code(decoder->error() == ChunkedDecoder::Error::too_large ? errc::message_size : errc::protocol_error));
+        return;
+      }
+      // Writing to the content file consumes the decoded content, but leaves the bytes following it in the put area intact
+      auto &content = session->request->content;
+      if(content.file_ || streambuf.size() > config.content_file_threshold) {
+        if(!this->write_content_file(session, streambuf.size()))
+          return;
+        if(content.file_size > config.max_content_file_size) {
           auto response = std::shared_ptr<Response>(new Response(session, this->config.timeout_content));
           response->write(StatusCode::client_error_payload_too_large);
           response->send();
@@ -610,19 +868,37 @@ namespace SimpleWeb {
           return;
         }
       }
+      if(!decoder->complete()) {
+        read_chunked_transfer_encoded(session, decoder);
+        return;
+      }
 
-      // Remove "\r\n"
-      session->request->content.get();
-      session->request->content.get();
+      for(auto &field : decoder->trailer)
+        session->request->header.emplace(field.first, field.second);
+      // The rest of the bytes are the start of the next request
+      session->connection->pipelined_data.assign(data + consumed, size - consumed);
+      if(content.file_ && !this->open_content_file(session))
+        return;
+      this->find_resource(session);
+    }
+
+    /// Moves the data following the first content_size bytes of the request stream buffer to the connection,
+    /// where it is used by the next request on the connection.
+    void save_pipelined_data(const std::shared_ptr<Session> &session, std::size_t content_size) {
+      auto &streambuf = session->request->streambuf;
+      if(streambuf.size() <= content_size)
+        return;
+      if(on_upgrade && session->request->header.find("Upgrade") != session->request->header.end())
+        return; // Data following an upgrade request is left to the upgraded connection
 
-      if(length > 0)
-        read_chunked_transfer_encoded(session, chunks_streambuf);
+      auto data = asio::buffer_cast<const char *>(streambuf.data());
+      session->connection->pipelined_data.assign(data + content_size, streambuf.size() - content_size);
+      if(content_size == 0)
+        streambuf.consume(streambuf.size());
       else {
-        if(chunks_streambuf->size() > 0) {
-          std::ostream ostream(&session->request->streambuf);
-          ostream << chunks_streambuf.get();
-        }
-        this->find_resource(session);
+        std::string content(data, content_size);
+        streambuf.consume(streambuf.size());
+        streambuf.commit(asio::buffer_copy(streambuf.prepare(content_size), asio::buffer(content)));
       }
     }
 
@@ -663,8 +939,10 @@ namespace SimpleWeb {
     void write(const std::shared_ptr<Session> &session,
                std::function<void(std::shared_ptr<typename ServerBase<socket_type>::Response>, std::shared_ptr<typename ServerBase<socket_type>::Request>)> &resource_function) {
       session->connection->set_timeout(config.timeout_content);
-      auto response = std::shared_ptr<Response>(new Response(session, config.timeout_content), [this](Response *response_ptr) {
-        auto response = std::shared_ptr<Response>(response_ptr);
+      auto &arena = session->connection->arena;
+      auto response = std::shared_ptr<Response>(new(arena->allocate(sizeof(Response), alignof(Response))) Response(session, config.timeout_content), [this](Response *response_ptr) {
+        auto &arena = response_ptr->session->connection->arena;
+        auto response = std::shared_ptr<Response>(response_ptr, ArenaDeleter<Response>(arena), ArenaAllocator<Response>(arena));
         response->send([this, response](const error_code &ec) {
           if(!ec) {
             if(response->close_connection_after_response)
@@ -675,13 +953,13 @@ namespace SimpleWeb {
               if(case_insensitive_equal(it->second, "close"))
                 return;
               else if(case_insensitive_equal(it->second, "keep-alive")) {
-                auto new_session = std::make_shared<Session>(this->config.max_request_streambuf_size, response->session->connection);
+                auto new_session = this->create_session(response->session->connection);
                 this->read(new_session);
                 return;
               }
             }
             if(response->session->request->http_version >= "1.1") {
-              auto new_session = std::make_shared<Session>(this->config.max_request_streambuf_size, response->session->connection);
+              auto new_session = this->create_session(response->session->connection);
               this->read(new_session);
               return;
             }
@@ -689,7 +967,7 @@ namespace SimpleWeb {
           else if(this->on_error)
             this->on_error(response->session->request, ec);
         });
-      });
+      }, ArenaAllocator<Response>(arena));
 
       try {
         resource_function(response, session->request);
@@ -725,7 +1003,7 @@ namespace SimpleWeb {
         if(ec != asio::error::operation_aborted)
           this->accept();
 
-        auto session = std::make_shared<Session>(config.max_request_streambuf_size, connection);
+        auto session = create_session(connection);
 
         if(!ec) {
           asio::ip::tcp::no_delay option(true);
@@ -10,7 +10,22 @@
 #endif
 
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+#if(defined(USE_STANDALONE_ASIO) && ASIO_VERSION >= 101100) || (!defined(USE_STANDALONE_ASIO) && BOOST_ASIO_VERSION >= 101100)
+#define SIMPLE_WEB_HANDSHAKE_THREADS
+#endif
 
 namespace SimpleWeb {
   using HTTPS = asio::ssl::stream<asio::ip::tcp::socket>;
@@ -20,6 +35,68 @@ namespace SimpleWeb {
     bool set_session_id_context = false;
 
   public:
+    /// TLS protocol and session settings, applied when start() is called.
+    /// Note that kernel TLS (SSL_OP_ENABLE_KTLS) cannot be used: asio::ssl::stream passes records through a memory BIO pair
+    /// instead of a socket BIO, so OpenSSL always encrypts in user space and sendfile() is not possible for HTTPS.
+    class TlsConfig {
+    public:
+      /// Minimum protocol version, for instance TLS1_2_VERSION. Defaults to TLS 1.2.
+      /// Before OpenSSL 1.1.0, only TLS 1.2 is supported, and the versions outside of the range are disabled with SSL_OP_NO_* options.
+      int min_version = TLS1_2_VERSION;
+#ifdef TLS1_3_VERSION
+      /// Maximum protocol version, for instance TLS1_2_VERSION. Defaults to TLS 1.3.
+      int max_version = TLS1_3_VERSION;
+      /// Number of TLS 1.3 session tickets sent to a client after a full handshake. Defaults to 2.
+      std::size_t tls13_tickets = 2;
+#else
+      /// Maximum protocol version. Defaults to TLS 1.2.
+      int max_version = TLS1_2_VERSION;
+#endif
+      /// Maximum number of sessions in the server-side session cache, which is shared by all threads.
+      /// Defaults to 20480. Set to 0 to disable the session cache.
+      long session_cache_size = 20480;
+      /// Seconds that sessions and session tickets can be resumed. Defaults to 7200.
+      long session_timeout = 7200;
+      /// Set to false to disable stateless session tickets. Defaults to true.
+      bool session_tickets = true;
+      /// Seconds between rotations of the session ticket key. Tickets encrypted with the previous key are still
+      /// accepted, and renewed. Defaults to 3600. Set to 0 to use the key of OpenSSL, which is not rotated.
+      long ticket_key_rotation = 3600;
+      /// Number of threads that run the CPU intensive steps of handshakes, such as private key operations, instead of
+      /// the threads that run io_service. Requires Asio 1.11.0 or Boost 1.66 or newer. Defaults to 0 (no handshake threads).
+      std::size_t handshake_threads = 0;
+      /// Maximum number of handshakes in progress. Further connections are closed. Defaults to 0 (no limit).
+      std::size_t max_handshakes = 0;
+    };
+
+    /// TLS session resumption statistics
+    class TlsSessionStatistics {
+    public:
+      /// Number of handshakes where a session was resumed, from the session cache or a session ticket
+      std::size_t resumed = 0;
+      /// Number of full handshakes
+      std::size_t full = 0;
+    };
+
+    /// Handshake statistics
+    class HandshakeStatistics {
+    public:
+      std::size_t completed = 0;
+      std::size_t failed = 0;
+      /// Number of connections closed because max_handshakes was reached
+      std::size_t rejected = 0;
+      /// Time from the start of a handshake until it has completed, including network round trips
+      std::chrono::steady_clock::duration total_handshake_time = std::chrono::steady_clock::duration::zero();
+      std::chrono::steady_clock::duration max_handshake_time = std::chrono::steady_clock::duration::zero();
+      /// Time until a task posted to the handshake threads at the start of each handshake is run. This approximates how long
+      /// the steps of a handshake wait for the handshake threads, which are not measured individually.
+      std::chrono::steady_clock::duration total_pool_latency = std::chrono::steady_clock::duration::zero();
+      std::chrono::steady_clock::duration max_pool_latency = std::chrono::steady_clock::duration::zero();
+    };
+
+    /// Set before calling start().
+    TlsConfig tls_config;
+
     Server(const std::string &cert_file, const std::string &private_key_file, const std::string &verify_file = std::string())
         : ServerBase<HTTPS>::ServerBase(443), context(asio::ssl::context::tlsv12) {
       context.use_certificate_chain_file(cert_file);
@@ -30,11 +107,61 @@ namespace SimpleWeb {
         context.set_verify_mode(asio::ssl::verify_peer | asio::ssl::verify_fail_if_no_peer_cert | asio::ssl::verify_client_once);
         set_session_id_context = true;
       }
+
+      SSL_CTX_set_ex_data(context.native_handle(), server_ex_data_index(), this);
+    }
+
+    ~Server() noexcept {
+      // Stop accepting and close the connections, including those in a handshake, before the handshake threads are stopped
+      handler_runner->stop();
+      stop();
+
+      // Connections might keep the SSL_CTX after this server is destroyed
+      SSL_CTX_set_ex_data(context.native_handle(), server_ex_data_index(), nullptr);
+
+      // The handshake threads are not joined, since aborted handshakes complete on io_service, which might not be running.
+      // The threads exit when the remaining handshake steps have completed, or been destroyed with io_service.
+      if(handshake_io_service) {
+        handshake_work = nullptr;
+        for(auto &thread : handshake_thread_pool)
+          thread.detach();
+      }
+    }
+
+    /// Returns TLS session resumption statistics
+    TlsSessionStatistics tls_session_statistics() noexcept {
+      std::unique_lock<std::mutex> lock(tls_mutex);
+      return tls_statistics;
+    }
+
+    /// Returns handshake statistics
+    HandshakeStatistics handshake_statistics() noexcept {
+      std::unique_lock<std::mutex> lock(tls_mutex);
+      return handshake_stats;
     }
 
   protected:
     asio::ssl::context context;
 
+    class TicketKey {
+    public:
+      unsigned char name[16];
+      unsigned char aes_key[32];
+      unsigned char hmac_key[32];
+      std::chrono::steady_clock::time_point created;
+    };
+    /// Current and previous session ticket keys, used when tls_config.ticket_key_rotation is not 0
+    std::unique_ptr<TicketKey> ticket_key, previous_ticket_key;
+    TlsSessionStatistics tls_statistics;
+    HandshakeStatistics handshake_stats;
+    std::size_t handshakes = 0;
+    std::mutex tls_mutex;
+
+    /// Runs the handshake steps when tls_config.handshake_threads is set
+    std::shared_ptr<asio::io_service> handshake_io_service;
+    std::unique_ptr<asio::io_service::work> handshake_work;
+    std::vector<std::thread> handshake_thread_pool;
+
     void after_bind() override {
       if(set_session_id_context) {
         // Creating session_id_context from address:port but reversed due to small SSL_MAX_SSL_SESSION_ID_LENGTH
@@ -43,6 +170,119 @@ namespace SimpleWeb {
         SSL_CTX_set_session_id_context(context.native_handle(), reinterpret_cast<const unsigned char *>(session_id_context.data()),
                                        std::min<std::size_t>(session_id_context.size(), SSL_MAX_SSL_SESSION_ID_LENGTH));
       }
+
+      auto ctx = context.native_handle();
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+      SSL_CTX_set_min_proto_version(ctx, tls_config.min_version);
+      SSL_CTX_set_max_proto_version(ctx, tls_config.max_version);
+#else
+      // The versions outside of the range are disabled with options, since the context only supports TLS 1.2 before OpenSSL 1.1.0
+      long protocol_options = 0;
+      if(tls_config.min_version > TLS1_VERSION || tls_config.max_version < TLS1_VERSION)
+        protocol_options |= SSL_OP_NO_TLSv1;
+      if(tls_config.min_version > TLS1_1_VERSION || tls_config.max_version < TLS1_1_VERSION)
+        protocol_options |= SSL_OP_NO_TLSv1_1;
+      if(tls_config.min_version > TLS1_2_VERSION || tls_config.max_version < TLS1_2_VERSION)
+        protocol_options |= SSL_OP_NO_TLSv1_2;
+      SSL_CTX_set_options(ctx, protocol_options);
+#endif
+#ifdef TLS1_3_VERSION
+      SSL_CTX_set_num_tickets(ctx, tls_config.tls13_tickets);
+#endif
+      SSL_CTX_set_session_cache_mode(ctx, tls_config.session_cache_size > 0 ? SSL_SESS_CACHE_SERVER : SSL_SESS_CACHE_OFF);
+      SSL_CTX_sess_set_cache_size(ctx, tls_config.session_cache_size);
+      SSL_CTX_set_timeout(ctx, tls_config.session_timeout);
+      if(tls_config.session_tickets) {
+        SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+        if(tls_config.ticket_key_rotation > 0) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+          SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, &Server<HTTPS>::ticket_key_callback);
+#else
+          SSL_CTX_set_tlsext_ticket_key_cb(ctx, &Server<HTTPS>::ticket_key_callback);
+#endif
+        }
+      }
+      else
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+
+#ifdef SIMPLE_WEB_HANDSHAKE_THREADS
+      if(tls_config.handshake_threads > 0 && !handshake_io_service) {
+        handshake_io_service = std::make_shared<asio::io_service>();
+        handshake_work = std::unique_ptr<asio::io_service::work>(new asio::io_service::work(*handshake_io_service));
+        for(std::size_t c = 0; c < tls_config.handshake_threads; ++c) {
+          auto handshake_io_service = this->handshake_io_service;
+          handshake_thread_pool.emplace_back([handshake_io_service] {
+            handshake_io_service->run();
+          });
+        }
+      }
+#endif
+    }
+
+    static int server_ex_data_index() noexcept {
+      static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+      return index;
+    }
+
+    /// Returns the key that new tickets are encrypted with, and rotates the keys when the current key has expired.
+    /// tls_mutex must be locked.
+    const TicketKey *current_ticket_key() noexcept {
+      auto now = std::chrono::steady_clock::now();
+      if(!ticket_key || now - ticket_key->created >= std::chrono::seconds(tls_config.ticket_key_rotation)) {
+        std::unique_ptr<TicketKey> key(new TicketKey());
+        if(RAND_bytes(key->name, sizeof(key->name)) <= 0 || RAND_bytes(key->aes_key, sizeof(key->aes_key)) <= 0 ||
+           RAND_bytes(key->hmac_key, sizeof(key->hmac_key)) <= 0)
+          return nullptr;
+        key->created = now;
+        previous_ticket_key = std::move(ticket_key);
+        ticket_key = std::move(key);
+      }
+      return ticket_key.get();
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    using ticket_mac_ctx = EVP_MAC_CTX;
+    static bool init_ticket_mac(EVP_MAC_CTX *mac_ctx, const TicketKey *key) noexcept {
+      OSSL_PARAM params[] = {
+          OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char *>(key->hmac_key), sizeof(key->hmac_key)),
+          OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char *>("SHA256"), 0),
+          OSSL_PARAM_construct_end()};
+      return EVP_MAC_CTX_set_params(mac_ctx, params) == 1;
+    }
+#else
+    using ticket_mac_ctx = HMAC_CTX;
+    static bool init_ticket_mac(HMAC_CTX *mac_ctx, const TicketKey *key) noexcept {
+      return HMAC_Init_ex(mac_ctx, key->hmac_key, sizeof(key->hmac_key), EVP_sha256(), nullptr) == 1;
+    }
+#endif
+
+    /// Encrypts and decrypts session tickets with the rotating ticket keys
+    static int ticket_key_callback(SSL *ssl, unsigned char key_name[16], unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx, ticket_mac_ctx *mac_ctx, int encrypt) {
+      auto server = static_cast<Server<HTTPS> *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), server_ex_data_index()));
+      if(!server)
+        return -1;
+      std::unique_lock<std::mutex> lock(server->tls_mutex);
+      if(encrypt) {
+        auto key = server->current_ticket_key();
+        if(!key || RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0)
+          return -1;
+        std::memcpy(key_name, key->name, sizeof(key->name));
+        if(EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, key->aes_key, iv) != 1 || !init_ticket_mac(mac_ctx, key))
+          return -1;
+        return 1;
+      }
+      auto current_key = server->current_ticket_key();
+      const TicketKey *key = nullptr;
+      if(current_key && std::memcmp(key_name, current_key->name, sizeof(current_key->name)) == 0)
+        key = current_key;
+      else if(server->previous_ticket_key && std::memcmp(key_name, server->previous_ticket_key->name, sizeof(server->previous_ticket_key->name)) == 0 &&
+              std::chrono::steady_clock::now() - server->previous_ticket_key->created < std::chrono::seconds(2 * server->tls_config.ticket_key_rotation))
+        key = server->previous_ticket_key.get();
+      if(!key)
+        return 0; // Unknown or expired key: full handshake
+      if(EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, key->aes_key, iv) != 1 || !init_ticket_mac(mac_ctx, key))
+        return -1;
+      return key == current_key ? 1 : 2; // 2: renew tickets encrypted with the previous key
     }
 
     void accept() override {
@@ -56,24 +296,86 @@ namespace SimpleWeb {
         if(ec != asio::error::operation_aborted)
           this->accept();
 
-        auto session = std::make_shared<Session>(config.max_request_streambuf_size, connection);
+        auto session = create_session(connection);
 
         if(!ec) {
           asio::ip::tcp::no_delay option(true);
           error_code ec;
           session->connection->socket->lowest_layer().set_option(option, ec);
 
+          {
+            std::unique_lock<std::mutex> lock(tls_mutex);
+            if(tls_config.max_handshakes > 0 && handshakes >= tls_config.max_handshakes) {
+              ++handshake_stats.rejected;
+              lock.unlock();
+              session->connection->socket->lowest_layer().close(ec);
+              return;
+            }
+            ++handshakes;
+          }
+
+          auto start_time = std::chrono::steady_clock::now();
           session->connection->set_timeout(config.timeout_request);
-          session->connection->socket->async_handshake(asio::ssl::stream_base::server, [this, session](const error_code &ec) {
+          auto handler = [this, session, start_time](const error_code &ec) {
             session->connection->cancel_timeout();
             auto lock = session->connection->handler_runner->continue_lock();
             if(!lock)
               return;
+            {
+              std::unique_lock<std::mutex> lock(this->tls_mutex);
+              --this->handshakes;
+              if(!ec) {
+                ++this->handshake_stats.completed;
+                auto handshake_time = std::chrono::steady_clock::now() - start_time;
+                this->handshake_stats.total_handshake_time += handshake_time;
+                this->handshake_stats.max_handshake_time = std::max(this->handshake_stats.max_handshake_time, handshake_time);
+                if(SSL_session_reused(session->connection->socket->native_handle()))
+                  ++this->tls_statistics.resumed;
+                else
+                  ++this->tls_statistics.full;
+              }
+              else
+                ++this->handshake_stats.failed;
+            }
             if(!ec)
               this->read(session);
             else if(this->on_error)
               this->on_error(session->request, ec);
-          });
+          };
+#ifdef SIMPLE_WEB_HANDSHAKE_THREADS
+          if(handshake_io_service) {
+            handshake_io_service->post([this, session, start_time] {
+              auto lock = session->connection->handler_runner->continue_lock();
+              if(!lock)
+                return;
+              auto pool_latency = std::chrono::steady_clock::now() - start_time;
+              {
+                std::unique_lock<std::mutex> lock(this->tls_mutex);
+                this->handshake_stats.total_pool_latency += pool_latency;
+                this->handshake_stats.max_pool_latency = std::max(this->handshake_stats.max_pool_latency, pool_latency);
+              }
+            });
+            // The intermediate handlers of the handshake, which call SSL_do_handshake(), run on the handler's executor.
+            // The completion handler is posted back to io_service. Handshakes aborted by ~Server() complete after this
+            // server is destroyed: the handler keeps handshake_io_service, which its executor refers to, alive, while
+            // io_service is only referenced weakly since the handler might be queued in io_service itself.
+            auto handshake_io_service = this->handshake_io_service;
+            std::weak_ptr<asio::io_service> io_service_weak(this->io_service);
+            session->connection->socket->async_handshake(asio::ssl::stream_base::server, asio::bind_executor(handshake_io_service->get_executor(), [handshake_io_service, io_service_weak, session, handler](const error_code &ec) {
+              auto lock = session->connection->handler_runner->continue_lock();
+              if(!lock)
+                return;
+              auto io_service = io_service_weak.lock();
+              if(!io_service)
+                return;
+              io_service->post([handler, ec] {
+                handler(ec);
+              });
+            }));
+          }
+          else
+#endif
+            session->connection->socket->async_handshake(asio::ssl::stream_base::server, std::move(handler));
         }
         else if(this->on_error)
           this->on_error(session->request, ec);
@@ -0,0 +1,67 @@
+#include "client_http.hpp"
+#include "server_http.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+using namespace std;
+
+using HttpServer = SimpleWeb::Server<SimpleWeb::HTTP>;
+using HttpClient = SimpleWeb::Client<SimpleWeb::HTTP>;
+
+/// Counter of the operator new calls of the current thread, if set
+thread_local atomic<size_t> *allocations = nullptr;
+
+void *operator new(size_t size) {
+  if(allocations)
+    ++*allocations;
+  if(auto pointer = malloc(size > 0 ? size : 1))
+    return pointer;
+  throw bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept {
+  free(pointer);
+}
+
+/// Counts the operator new calls per request of a keep-alive connection, on the server and on the client.
+/// Usage: allocation_benchmark [number of requests]
+int main(int argc, char *argv[]) {
+  size_t requests = argc > 1 ? static_cast<size_t>(atol(argv[1])) : 10000;
+
+  atomic<size_t> server_allocations(0), client_allocations(0);
+
+  HttpServer server;
+  server.config.port = 0;
+  server.io_service = make_shared<SimpleWeb::asio::io_service>();
+  server.resource["^/$"]["GET"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> /*request*/) {
+    response->write("test");
+  };
+  auto port = server.bind();
+  server.accept_and_run();
+  thread server_thread([&server, &server_allocations] {
+    allocations = &server_allocations;
+    server.io_service->run();
+  });
+
+  {
+    HttpClient client("localhost:" + to_string(port));
+    for(size_t c = 0; c < 100; ++c) // Warm up the connection and the caches of Asio
+      client.request("GET", "/");
+
+    server_allocations = 0;
+    allocations = &client_allocations;
+    for(size_t c = 0; c < requests; ++c)
+      client.request("GET", "/");
+    allocations = nullptr;
+  }
+
+  server.stop();
+  server.io_service->stop();
+  server_thread.join();
+
+  cout << "Requests: " << requests << endl;
+  cout << "Server: " << static_cast<double>(server_allocations) / static_cast<double>(requests) << " operator new calls per request" << endl;
+  cout << "Client: " << static_cast<double>(client_allocations) / static_cast<double>(requests) << " operator new calls per request" << endl;
+}
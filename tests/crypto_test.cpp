@@ -1,4 +1,11 @@
 #include <cassert>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "crypto.hpp"
@@ -17,6 +24,13 @@ const vector<pair<string, string>> base64_string_tests = {
     {"The itsy bitsy spider climbed up the waterspout.\r\nDown came the rain\r\nand washed the spider out.\r\nOut came the sun\r\nand dried up all the rain\r\nand the itsy bitsy spider climbed up the spout again.",
      "VGhlIGl0c3kgYml0c3kgc3BpZGVyIGNsaW1iZWQgdXAgdGhlIHdhdGVyc3BvdXQuDQpEb3duIGNhbWUgdGhlIHJhaW4NCmFuZCB3YXNoZWQgdGhlIHNwaWRlciBvdXQuDQpPdXQgY2FtZSB0aGUgc3VuDQphbmQgZHJpZWQgdXAgYWxsIHRoZSByYWluDQphbmQgdGhlIGl0c3kgYml0c3kgc3BpZGVyIGNsaW1iZWQgdXAgdGhlIHNwb3V0IGFnYWluLg=="}};
 
+const vector<pair<string, string>> base64url_string_tests = {
+    {"", ""},
+    {"f", "Zg"},
+    {"fo", "Zm8"},
+    {"foo", "Zm9v"},
+    {"\xfb\xff\xbf", "-_-_"}};
+
 const vector<pair<string, string>> md5_string_tests = {
     {"", "d41d8cd98f00b204e9800998ecf8427e"},
     {"The quick brown fox jumps over the lazy dog", "9e107d9d372bb6826bd81d3542a419d6"}};
@@ -33,12 +47,119 @@ const vector<pair<string, string>> sha512_string_tests = {
     {"", "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e"},
     {"The quick brown fox jumps over the lazy dog", "07e547d9586f6a73f73fbac0435ed76951218fb7d0c8d788a309d785436bbb642e93a252a954f23912547d1e8a3b5ed6e1bfd7097821233fa0538f3db854fee6"}};
 
+/// Runs the posted functions in the calling thread
+class IoService {
+public:
+  void post(function<void()> &&function) {
+    lock_guard<mutex> lock(functions_mutex);
+    functions.emplace_back(move(function));
+    condition_variable.notify_one();
+  }
+
+  /// Runs the given number of posted functions, and waits for them to be posted
+  void run(size_t count) {
+    for(size_t c = 0; c < count; ++c) {
+      unique_lock<mutex> lock(functions_mutex);
+      condition_variable.wait(lock, [this] { return !functions.empty(); });
+      auto function = move(functions.front());
+      functions.pop_front();
+      lock.unlock();
+      function();
+    }
+  }
+
+private:
+  deque<function<void()>> functions;
+  mutex functions_mutex;
+  std::condition_variable condition_variable;
+};
+
 int main() {
   for(auto &string_test : base64_string_tests) {
     assert(Crypto::Base64::encode(string_test.first) == string_test.second);
     assert(Crypto::Base64::decode(string_test.second) == string_test.first);
   }
 
+  for(auto &string_test : base64_string_tests) {
+    string base64;
+    Crypto::Base64::Encoder encoder;
+    for(auto &chr : string_test.first)
+      encoder.write(&chr, 1, base64);
+    encoder.finish(base64);
+    assert(base64 == string_test.second);
+
+    string ascii;
+    Crypto::Base64::Decoder decoder;
+    for(auto &chr : string_test.second)
+      assert(decoder.write(&chr, 1, ascii));
+    assert(decoder.finish(ascii));
+    assert(ascii == string_test.first);
+  }
+
+  for(auto &string_test : base64url_string_tests) {
+    assert(Crypto::Base64Url::encode(string_test.first) == string_test.second);
+    assert(Crypto::Base64Url::decode(string_test.second) == string_test.first);
+  }
+  assert(Crypto::Base64Url::decode("Zm8=") == "fo");
+
+  // Invalid input
+  for(auto &base64 : {"Zg", "Zg=", "Zm9v YmFy", "Zm9v!mFy", "Zm=9v", "====", "Zg==Zg==", "Zm9vYmFy====", "-_-_"})
+    assert(Crypto::Base64::decode(base64).empty());
+  for(auto &base64 : {"Z", "Zg=", "Zm9v+mFy", "Zm9v/mFy"})
+    assert(Crypto::Base64Url::decode(base64).empty());
+  {
+    string ascii;
+    Crypto::Base64::Decoder decoder;
+    assert(decoder.write("Zg==", 4, ascii));
+    assert(!decoder.write("Zg==", 4, ascii));
+    assert(!decoder.finish(ascii));
+  }
+  {
+    string ascii;
+    Crypto::Base64::Decoder decoder;
+    assert(decoder.write("Zm9", 3, ascii));
+    assert(!decoder.finish(ascii));
+  }
+
+  // Lengths and offsets that exercise both the vectorized and the remaining scalar parts
+  for(size_t size = 0; size < 300; ++size) {
+    string ascii;
+    for(size_t c = 0; c < size; ++c)
+      ascii += static_cast<char>((c * 7 + size) % 256);
+    auto base64 = Crypto::Base64::encode(ascii);
+    assert(base64.size() == Crypto::Base64::encoded_size(size));
+    assert(Crypto::Base64::decode(base64) == ascii);
+
+    auto base64url = Crypto::Base64Url::encode(ascii);
+    assert(base64url.size() == Crypto::Base64Url::encoded_size(size));
+    auto expected = base64;
+    while(!expected.empty() && expected.back() == '=')
+      expected.pop_back();
+    for(auto &chr : expected) {
+      if(chr == '+')
+        chr = '-';
+      else if(chr == '/')
+        chr = '_';
+    }
+    assert(base64url == expected);
+    assert(Crypto::Base64Url::decode(base64url) == ascii);
+
+    string streamed;
+    Crypto::Base64::Encoder encoder;
+    for(size_t c = 0; c < size; c += 5)
+      encoder.write(ascii.data() + c, min<size_t>(5, size - c), streamed);
+    encoder.finish(streamed);
+    assert(streamed == base64);
+
+    if(!base64.empty()) {
+      for(size_t position = 0; position < base64.size(); position += 13) {
+        auto invalid = base64;
+        invalid[position] = '.';
+        assert(Crypto::Base64::decode(invalid).empty());
+      }
+    }
+  }
+
   for(auto &string_test : md5_string_tests) {
     assert(Crypto::to_hex_string(Crypto::md5(string_test.first)) == string_test.second);
     stringstream ss(string_test.first);
@@ -63,6 +184,75 @@ int main() {
     assert(Crypto::to_hex_string(Crypto::sha512(ss)) == string_test.second);
   }
 
+  for(auto &string_test : sha256_string_tests) {
+    Crypto::Hash hash(Crypto::Hash::Algorithm::sha256);
+    for(auto &chr : string_test.first)
+      hash.update(&chr, 1);
+    assert(Crypto::to_hex_string(hash.final()) == string_test.second);
+    // Reused after final()
+    hash.update(string_test.first);
+    assert(Crypto::to_hex_string(hash.final()) == string_test.second);
+  }
+
+  {
+    vector<string> paths;
+    for(size_t c = 0; c < 3; ++c) {
+      paths.emplace_back("crypto_test_file" + to_string(c));
+      ofstream file(paths.back(), ios::binary);
+      file << (c == 0 ? "" : sha512_string_tests[1].first);
+    }
+    paths.emplace_back("crypto_test_file_missing");
+
+    Crypto::Hash hash(Crypto::Hash::Algorithm::sha512);
+    assert(hash.update_file(paths[1]));
+    assert(Crypto::to_hex_string(hash.final()) == sha512_string_tests[1].second);
+    assert(!hash.update_file(paths[3]));
+    assert(!hash.update_file("."));
+#ifdef __linux__
+    // Files of the proc file system report size 0, and are read as streams
+    {
+      ifstream stream("/proc/version", ios::binary);
+      stringstream content;
+      content << stream.rdbuf();
+      assert(!content.str().empty());
+      assert(hash.update_file("/proc/version"));
+      assert(hash.final() == Crypto::sha512(content.str()));
+    }
+#endif
+
+    for(size_t threads = 1; threads < 6; ++threads) {
+      auto hashes = Crypto::hash_files(paths, Crypto::Hash::Algorithm::md5, threads);
+      assert(hashes.size() == 4);
+      assert(Crypto::to_hex_string(hashes[0]) == md5_string_tests[0].second);
+      assert(Crypto::to_hex_string(hashes[1]) == md5_string_tests[1].second);
+      assert(Crypto::to_hex_string(hashes[2]) == md5_string_tests[1].second);
+      assert(hashes[3].empty());
+    }
+
+    for(size_t c = 0; c < 3; ++c)
+      remove(paths[c].c_str());
+  }
+
+  {
+    // Test cases 2 and 6 from RFC 4231
+    Crypto::Hmac hmac("Jefe");
+    auto signature = hmac.sign("what do ya want for nothing?");
+    assert(Crypto::to_hex_string(signature) == "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+    assert(Crypto::to_hex_string(hmac.sign("what do ya want for nothing?")) == "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+    assert(hmac.verify("what do ya want for nothing?", signature));
+    assert(!hmac.verify("what do ya want for nothing!", signature));
+    assert(!hmac.verify("what do ya want for nothing?", signature.substr(1)));
+    signature[0] ^= 1;
+    assert(!hmac.verify("what do ya want for nothing?", signature));
+
+    Crypto::Hmac hmac_sha512("Jefe", Crypto::Hash::Algorithm::sha512);
+    assert(hmac_sha512.size() == 512 / 8);
+    assert(Crypto::to_hex_string(hmac_sha512.sign("what do ya want for nothing?")) == "164b7a7bfcf819e2e395fbe73b56e0a387bd64222e831fd610270cd7ea2505549758bf75c05a994a6d034f65f8f0e6fdcaeab1a34d4a6b4b636e070a38bce737");
+
+    Crypto::Hmac hmac_long_key(string(131, '\xaa'));
+    assert(Crypto::to_hex_string(hmac_long_key.sign("Test Using Larger Than Block-Size Key - Hash Key First")) == "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54");
+  }
+
   // Testing iterations
   assert(Crypto::to_hex_string(Crypto::sha1("Test", 1)) == "640ab2bae07bedc4c163f679a746f7ab7fb5d1fa");
   assert(Crypto::to_hex_string(Crypto::sha1("Test", 2)) == "af31c6cbdecd88726d0a9b3798c71ef41f1624d5");
@@ -71,4 +261,43 @@ int main() {
 
   assert(Crypto::to_hex_string(Crypto::pbkdf2("Password", "Salt", 4096, 128 / 8)) == "f66df50f8aaa11e4d9721e1312ff2e66");
   assert(Crypto::to_hex_string(Crypto::pbkdf2("Password", "Salt", 8192, 512 / 8)) == "a941ccbc34d1ee8ebbd1d34824a419c3dc4eac9cbc7c36ae6c7ca8725e2b618a6ad22241e787af937b0960cf85aa8ea3a258f243e05d3cc9b08af5dd93be046c");
+  assert(Crypto::to_hex_string(Crypto::pbkdf2("password", "salt", 1, 32, Crypto::Hash::Algorithm::sha256)) == "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b");
+  assert(Crypto::to_hex_string(Crypto::pbkdf2("password", "salt", 2, 32, Crypto::Hash::Algorithm::sha256)) == "ae4d0c95af6b46d32d0adff928f06dd02a303f8ef3c251dfd6e2d85a95474c43");
+
+  {
+    IoService io_service;
+    vector<string> keys;
+    vector<bool> verified;
+    {
+      Crypto::Pbkdf2Service service(2);
+      for(int c = 0; c < 4; ++c) {
+        assert(service.pbkdf2(io_service, "Password", "Salt", 4096, 128 / 8, Crypto::Hash::Algorithm::sha1, [&keys](string key) {
+          keys.emplace_back(move(key));
+        }));
+      }
+      auto expected_key = Crypto::pbkdf2("password", "salt", 2, 32, Crypto::Hash::Algorithm::sha256);
+      assert(service.verify(io_service, "password", "salt", 2, Crypto::Hash::Algorithm::sha256, expected_key, [&verified](bool result) {
+        verified.emplace_back(result);
+      }));
+      assert(service.verify(io_service, "wrong password", "salt", 2, Crypto::Hash::Algorithm::sha256, expected_key, [&verified](bool result) {
+        verified.emplace_back(result);
+      }));
+      io_service.run(6);
+      while(service.statistics().completed < 6)
+        this_thread::yield();
+      auto statistics = service.statistics();
+      assert(statistics.completed == 6 && statistics.queued == 0 && statistics.running == 0 && statistics.rejected == 0);
+      assert(statistics.max_queued >= 1);
+    }
+    assert(keys.size() == 4);
+    for(auto &key : keys)
+      assert(Crypto::to_hex_string(key) == "f66df50f8aaa11e4d9721e1312ff2e66");
+    assert(verified.size() == 2 && verified[0] != verified[1]);
+
+    // Rejected when the queue is full
+    Crypto::Pbkdf2Service service(0, 1);
+    assert(service.pbkdf2(io_service, "Password", "Salt", 1, 16, Crypto::Hash::Algorithm::sha1, [](string) {}));
+    assert(!service.pbkdf2(io_service, "Password", "Salt", 1, 16, Crypto::Hash::Algorithm::sha1, [](string) {}));
+    assert(service.statistics().queued == 1 && service.statistics().rejected == 1);
+  }
 }
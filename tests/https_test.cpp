@@ -0,0 +1,108 @@
+#include "client_https.hpp"
+#include "server_https.hpp"
+#include <cassert>
+#include <cstdio>
+#include <future>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+using namespace std;
+
+using HttpsServer = SimpleWeb::Server<SimpleWeb::HTTPS>;
+using HttpsClient = SimpleWeb::Client<SimpleWeb::HTTPS>;
+
+/// Writes a self-signed certificate and its private key to the given files
+void write_certificate(const string &cert_file, const string &private_key_file) {
+  EVP_PKEY *key = nullptr;
+  auto key_context = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+  assert(key_context);
+  assert(EVP_PKEY_keygen_init(key_context) == 1);
+  assert(EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_context, NID_X9_62_prime256v1) == 1);
+  assert(EVP_PKEY_keygen(key_context, &key) == 1);
+  EVP_PKEY_CTX_free(key_context);
+
+  auto cert = X509_new();
+  assert(cert);
+  X509_set_version(cert, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_get_notBefore(cert), 0);
+  X509_gmtime_adj(X509_get_notAfter(cert), 3600);
+  X509_set_pubkey(cert, key);
+  auto name = X509_get_subject_name(cert);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+  X509_set_issuer_name(cert, name);
+  assert(X509_sign(cert, key, EVP_sha256()) > 0);
+
+  auto file = fopen(cert_file.c_str(), "w");
+  assert(file);
+  assert(PEM_write_X509(file, cert) == 1);
+  fclose(file);
+  file = fopen(private_key_file.c_str(), "w");
+  assert(file);
+  assert(PEM_write_PrivateKey(file, key, nullptr, nullptr, 0, nullptr, nullptr) == 1);
+  fclose(file);
+
+  X509_free(cert);
+  EVP_PKEY_free(key);
+}
+
+int main() {
+  string cert_file = "https_test_server.crt";
+  string private_key_file = "https_test_server.key";
+  write_certificate(cert_file, private_key_file);
+
+#ifdef SIMPLE_WEB_HANDSHAKE_THREADS
+  // Test destroying a server with handshake threads during handshakes, while its external io_service keeps running
+  {
+    auto io_service = make_shared<SimpleWeb::asio::io_service>();
+    SimpleWeb::asio::io_service::work work(*io_service);
+    thread io_thread([io_service] {
+      io_service->run();
+    });
+
+    for(size_t iteration = 0; iteration < 5; ++iteration) {
+      SimpleWeb::asio::io_service client_io_service;
+      vector<unique_ptr<SimpleWeb::asio::ip::tcp::socket>> sockets;
+      promise<void> destroyed;
+      shared_future<void> server_destroyed = destroyed.get_future();
+      {
+        HttpsServer server(cert_file, private_key_file);
+        server.config.port = 0;
+        server.io_service = io_service;
+        server.tls_config.handshake_threads = 2;
+        server.resource["^/$"]["GET"] = [](shared_ptr<HttpsServer::Response> response, shared_ptr<HttpsServer::Request> /*request*/) {
+          response->write("test");
+        };
+        auto port = server.bind();
+        server.accept_and_run();
+
+        {
+          HttpsClient client("localhost:" + to_string(port), false);
+          assert(client.request("GET", "/")->content.string() == "test");
+        }
+
+        // Connections that have not sent a ClientHello are left in a handshake
+        for(size_t c = 0; c < 4; ++c) {
+          sockets.emplace_back(new SimpleWeb::asio::ip::tcp::socket(client_io_service));
+          sockets.back()->connect(SimpleWeb::asio::ip::tcp::endpoint(SimpleWeb::asio::ip::address::from_string("127.0.0.1"), port));
+        }
+        this_thread::sleep_for(chrono::milliseconds(50));
+        assert(server.handshake_statistics().completed == 1);
+
+        // Block io_service so that the aborted handshakes complete after the server has been destroyed
+        io_service->post([server_destroyed] {
+          server_destroyed.wait();
+        });
+      }
+      destroyed.set_value();
+      this_thread::sleep_for(chrono::milliseconds(50));
+    }
+
+    io_service->stop();
+    io_thread.join();
+  }
+#endif
+
+  remove(cert_file.c_str());
+  remove(private_key_file.c_str());
+}
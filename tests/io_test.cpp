@@ -1,7 +1,10 @@
 #include "client_http.hpp"
 #include "server_http.hpp"
 
+#include <atomic>
 #include <cassert>
+#include <cstdio>
+#include <fstream>
 
 using namespace std;
 
@@ -12,52 +15,79 @@ namespace asio = boost::asio;
 using HttpServer = SimpleWeb::Server<SimpleWeb::HTTP>;
 using HttpClient = SimpleWeb::Client<SimpleWeb::HTTP>;
 
+#ifdef HAVE_ZLIB
+string compress(const string &data, int window_bits) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+  string compressed(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  stream.next_out = reinterpret_cast<Bytef *>(&compressed[0]);
+  stream.avail_out = static_cast<uInt>(compressed.size());
+  deflate(&stream, Z_FINISH);
+  compressed.resize(stream.total_out);
+  deflateEnd(&stream);
+  return compressed;
+}
+
+string uncompressed_content() {
+  string content;
+  for(size_t c = 0; c < 10000; ++c)
+    content += "{\"id\":" + to_string(c) + "}";
+  return content;
+}
+#endif
+
 int main() {
   // Test ScopeRunner
   {
     SimpleWeb::ScopeRunner scope_runner;
     std::thread cancel_thread;
     {
-      assert(scope_runner.count == 0);
+      assert(scope_runner.count() == 0);
       auto lock = scope_runner.continue_lock();
       assert(lock);
-      assert(scope_runner.count == 1);
+      assert(scope_runner.count() == 1);
       {
         auto lock = scope_runner.continue_lock();
         assert(lock);
-        assert(scope_runner.count == 2);
+        assert(scope_runner.count() == 2);
       }
-      assert(scope_runner.count == 1);
+      assert(scope_runner.count() == 1);
       cancel_thread = thread([&scope_runner] {
         scope_runner.stop();
-        assert(scope_runner.count == -1);
+        assert(scope_runner.count() == -1);
       });
       this_thread::sleep_for(chrono::milliseconds(500));
-      assert(scope_runner.count == 1);
+      assert(scope_runner.count() == 1);
     }
     cancel_thread.join();
-    assert(scope_runner.count == -1);
+    assert(scope_runner.count() == -1);
     auto lock = scope_runner.continue_lock();
     assert(!lock);
     scope_runner.stop();
-    assert(scope_runner.count == -1);
-
-    scope_runner.count = 0;
-
+    assert(scope_runner.count() == -1);
+  }
+  {
+    SimpleWeb::ScopeRunner scope_runner;
     vector<thread> threads;
     for(size_t c = 0; c < 100; ++c) {
       threads.emplace_back([&scope_runner] {
         auto lock = scope_runner.continue_lock();
-        assert(scope_runner.count > 0);
+        assert(scope_runner.count() > 0);
       });
     }
     for(auto &thread : threads)
       thread.join();
-    assert(scope_runner.count == 0);
+    assert(scope_runner.count() == 0);
   }
 
   HttpServer server;
   server.config.port = 8080;
+  server.config.parse_multipart = true;
+  server.config.multipart_memory_limit = 8;
+  server.config.content_file_threshold = 256;
 
   server.resource["^/string$"]["POST"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
     auto content = request->content.string();
@@ -83,6 +113,13 @@ int main() {
     response->write(SimpleWeb::StatusCode::client_error_forbidden, {{"Test1", "test2"}, {"tesT3", "test4"}});
   };
 
+  server.resource["^/append$"]["POST"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+    auto content = request->content.string();
+    response->reserve(content.size() + 64);
+    response->append("HTTP/1.1 200 OK\r\nContent-Length: ").append(content.size() + 9).append("\r\n\r\n");
+    response->append(content).append(' ').append(-42).append(' ').append(0.5, 2);
+  };
+
   server.resource["^/info$"]["GET"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
     stringstream content_stream;
     content_stream << request->method << " " << request->path << " " << request->http_version << " ";
@@ -108,6 +145,43 @@ int main() {
               << number;
   };
 
+  server.resource["^/close$"]["GET"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> /*request*/) {
+    response->close_connection_after_response = true;
+    *response << "HTTP/1.1 200 OK\r\nContent-Length: 6\r\n\r\nclosed";
+  };
+
+  server.resource["^/large$"]["GET"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> /*request*/) {
+    response->write(string(100000, 'a'));
+  };
+  server.resource["^/large$"]["HEAD"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> /*request*/) {
+    *response << "HTTP/1.1 200 OK\r\nContent-Length: 100000\r\n\r\n";
+  };
+
+  server.resource["^/chunked$"]["GET"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> /*request*/) {
+    *response << "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nHello\r\n6;ext=1\r\n world\r\n0\r\nTrailer: x\r\n\r\n";
+  };
+
+#ifdef HAVE_ZLIB
+  server.resource["^/gzip$"]["GET"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+    assert(request->header.find("Accept-Encoding")->second == "gzip, deflate");
+    auto compressed = compress(uncompressed_content(), 15 + 16);
+    if(request->query_string == "truncated")
+      compressed.resize(compressed.size() / 2);
+    response->write(compressed, {{"Content-Encoding", "gzip"}});
+  };
+
+  server.resource["^/deflate$"]["GET"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+    auto compressed = compress(uncompressed_content(), request->query_string == "raw" ? -15 : 15);
+    *response << "HTTP/1.1 200 OK\r\nContent-Encoding: deflate\r\nTransfer-Encoding: chunked\r\n\r\n";
+    for(size_t position = 0; position < compressed.size(); position += 1000) {
+      auto chunk = compressed.substr(position, 1000);
+      *response << hex << chunk.size() << "\r\n"
+                << chunk << "\r\n";
+    }
+    *response << "0\r\n\r\n";
+  };
+
+#endif
   server.resource["^/header$"]["GET"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
     auto content = request->header.find("test1")->second + request->header.find("test2")->second;
 
@@ -132,6 +206,40 @@ int main() {
     response->write("6\r\nSimple\r\n3\r\nWeb\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\n\r\n", {{"Transfer-Encoding", "chunked"}});
   };
 
+  server.resource["^/chunked_trailer$"]["POST"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+    assert(request->content.string() == "SimpleWeb in\r\n\r\nchunks.");
+    auto it = request->header.find("Checksum");
+    assert(it != request->header.end() && it->second == "abc");
+
+    response->write("6;name=value\r\nSimple\r\n3\r\nWeb\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\nChecksum: def\r\n\r\n", {{"Transfer-Encoding", "chunked"}});
+  };
+
+  server.resource["^/content_file$"]["POST"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+    assert(request->content.file() && request->content.fd() != -1);
+    auto size = request->content.size();
+    auto mapped = request->content.map();
+    assert(mapped);
+    auto content = request->content.string();
+    assert(content.size() == size && content == string(mapped.get(), size));
+    response->write(content);
+  };
+
+  server.resource["^/multipart$"]["POST"] = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+    assert(request->multipart && request->content.size() == 0);
+    stringstream stream;
+    for(auto &part : request->multipart->parts) {
+      stream << part.name << ',' << part.filename << ',' << part.size << ',' << (part.file ? "file" : "memory") << ',';
+      if(part.file) {
+        std::string content(part.size, '\0');
+        assert(fread(&content[0], 1, part.size, part.file.get()) == part.size);
+        stream << content << ';';
+      }
+      else
+        stream << part.content << ';';
+    }
+    response->write(stream);
+  };
+
   thread server_thread([&server]() {
     // Start server
     server.start();
@@ -202,6 +310,12 @@ int main() {
       assert(output.str() == "A string");
     }
 
+    {
+      auto r = client.request("POST", "/append", "A string");
+      assert(SimpleWeb::status_code(r->status_code) == SimpleWeb::StatusCode::success_ok);
+      assert(r->content.string() == "A string -42 0.50");
+    }
+
     {
       stringstream output;
       auto r = client.request("GET", "/info", "", {{"Test Parameter", "test value"}});
@@ -219,6 +333,37 @@ int main() {
       auto r = client.request("POST", "/chunked", "6\r\nSimple\r\n3\r\nWeb\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\n\r\n", {{"Transfer-Encoding", "chunked"}});
       assert(r->content.string() == "SimpleWeb in\r\n\r\nchunks.");
     }
+    {
+      auto r = client.request("POST", "/chunked_trailer", "6;name=value\r\nSimple\r\n3\r\nWeb\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\nChecksum: abc\r\n\r\n", {{"Transfer-Encoding", "chunked"}});
+      assert(r->content.string() == "SimpleWeb in\r\n\r\nchunks.");
+      auto it = r->header.find("Checksum");
+      assert(it != r->header.end() && it->second == "def");
+    }
+    {
+      string content(100000, ' ');
+      for(size_t c = 0; c < content.size(); ++c)
+        content[c] = static_cast<char>('a' + c % 26);
+      auto r = client.request("POST", "/content_file", content);
+      assert(r->content.string() == content);
+
+      string chunked;
+      for(size_t c = 0; c < content.size(); c += 4096) {
+        auto chunk = content.substr(c, 4096);
+        stringstream size;
+        size << hex << chunk.size();
+        chunked += size.str() + "\r\n" + chunk + "\r\n";
+      }
+      chunked += "0\r\n\r\n";
+      r = client.request("POST", "/content_file", chunked, {{"Transfer-Encoding", "chunked"}});
+      assert(r->content.string() == content);
+    }
+    {
+      std::string content = "--xyz\r\nContent-Disposition: form-data; name=\"field\"\r\n\r\nvalue\r\n"
+                            "--xyz\r\nContent-Disposition: form-data; name=\"file\"; filename=\"a.txt\"\r\n\r\nfile\r\n--xy content\r\n"
+                            "--xyz--\r\n";
+      auto r = client.request("POST", "/multipart", content, {{"Content-Type", "multipart/form-data; boundary=xyz"}});
+      assert(r->content.string() == "field,,5,memory,value;file,a.txt,18,file,file\r\n--xy content;");
+    }
   }
   {
     HttpClient client("localhost:8080");
@@ -301,6 +446,505 @@ int main() {
     }
   }
 
+  // Test connection pool limits
+  {
+    HttpClient client("localhost:8080");
+    client.config.max_connections = 4;
+    client.config.max_idle_connections = 4;
+    client.config.min_idle_connections = 0;
+    client.config.timeout_idle = 1;
+    vector<int> calls(100, 0);
+    for(size_t c = 0; c < 100; ++c) {
+      client.request("GET", "/match/123", [c, &client, &calls](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+        assert(!ec);
+        assert(response->content.string() == "123");
+        assert(client.connections.size() <= 4);
+        calls[c] = 1;
+      });
+    }
+    assert(client.connections.size() == 4);
+    assert(client.pending_sessions.size() == 96);
+    client.io_service->run();
+    assert(client.connections.size() == 4);
+    assert(client.idle_connections.size() == 4);
+    assert(client.requests_in_flight == 0);
+    for(auto call : calls)
+      assert(call);
+    auto statistics = client.connect_statistics();
+    assert(statistics.resolves == 1);
+    assert(statistics.resolve_cache_hits == 0);
+    assert(statistics.connects == 4);
+
+    // Idle connections expire after timeout_idle
+    this_thread::sleep_for(chrono::milliseconds(1100));
+    client.io_service->reset();
+    auto r = client.request("GET", "/match/123");
+    assert(r->content.string() == "123");
+    assert(client.connections.size() == 1);
+    statistics = client.connect_statistics();
+    assert(statistics.resolves == 1);
+    assert(statistics.resolve_cache_hits == 1);
+    assert(statistics.connects == 5);
+  }
+  {
+    HttpClient client("localhost:8080");
+    client.config.max_requests_in_flight = 2;
+    client.config.max_idle_connections = 4;
+    vector<int> calls(10, 0);
+    for(size_t c = 0; c < 10; ++c) {
+      client.request("GET", "/match/123", [c, &calls](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+        assert(!ec);
+        assert(response->content.string() == "123");
+        calls[c] = 1;
+      });
+    }
+    assert(client.connections.size() == 2);
+    client.io_service->run();
+    assert(client.connections.size() == 2);
+    for(auto call : calls)
+      assert(call);
+  }
+
+  // Test request pipelining
+  {
+    HttpClient client("localhost:8080");
+    client.config.max_connections = 1;
+    client.config.max_pipelined_requests = 10;
+    vector<int> calls(20, 0);
+    for(size_t c = 0; c < 20; ++c) {
+      client.request("GET", "/match/" + to_string(c), [c, &calls](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+        assert(!ec);
+        assert(response->content.string() == to_string(c));
+        calls[c] = 1;
+      });
+    }
+    assert(client.connections.size() == 1);
+    assert((*client.connections.begin())->pipeline.size() == 10);
+    assert(client.pending_sessions.size() == 10);
+    client.io_service->run();
+    assert(client.connections.size() == 1);
+    assert(client.requests_in_flight == 0);
+    for(auto call : calls)
+      assert(call);
+    assert(client.connect_statistics().connects == 1);
+
+    // Non-idempotent requests are not pipelined
+    client.io_service->reset();
+    vector<int> calls2(2, 0);
+    client.request("GET", "/match/1", [&calls2](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      assert(response->content.string() == "1");
+      calls2[0] = 1;
+    });
+    client.request("POST", "/string", "A string", [&calls2](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      assert(response->content.string() == "A string");
+      calls2[1] = 1;
+    });
+    assert((*client.connections.begin())->pipeline.size() == 1);
+    assert(client.pending_sessions.size() == 1);
+    client.io_service->run();
+    for(auto call : calls2)
+      assert(call);
+  }
+  {
+    // Pipelined requests are retried on a new connection when the server closes the connection
+    HttpClient client("localhost:8080");
+    client.config.max_pipelined_requests = 10;
+    vector<int> calls(2, 0);
+    client.request("GET", "/close", [&calls](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      assert(response->content.string() == "closed");
+      calls[0] = 1;
+    });
+    client.request("GET", "/match/2", [&calls](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      assert(response->content.string() == "2");
+      calls[1] = 1;
+    });
+    assert(client.connections.size() == 1);
+    client.io_service->run();
+    for(auto call : calls)
+      assert(call);
+    assert(client.connect_statistics().connects == 2);
+  }
+
+  // Test streamed response content
+  {
+    HttpClient client("localhost:8080");
+    client.config.max_content_part_size = 1000;
+    size_t content_size = 0, parts = 0;
+    bool end = false;
+    client.request_stream("GET", "/large", [&](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      assert(response->status_code == "200 OK");
+      auto read_content = make_shared<function<void()>>();
+      *read_content = [&, response, read_content] {
+        response->read_content([&, response, read_content](const SimpleWeb::error_code &ec, bool end_) {
+          assert(!ec);
+          auto size = response->content.string().size();
+          assert(size <= 1000);
+          content_size += size;
+          ++parts;
+          if(end_) {
+            end = true;
+            *read_content = nullptr;
+          }
+          else
+            (*read_content)();
+        });
+      };
+      (*read_content)();
+    });
+    client.io_service->run();
+    assert(end);
+    assert(content_size == 100000);
+    assert(parts >= 100);
+
+    // Chunked response, reusing the connection
+    client.io_service->reset();
+    string content;
+    end = false;
+    client.request_stream("GET", "/chunked", [&](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      auto read_content = make_shared<function<void()>>();
+      *read_content = [&, response, read_content] {
+        response->read_content([&, response, read_content](const SimpleWeb::error_code &ec, bool end_) {
+          assert(!ec);
+          content += response->content.string();
+          if(end_) {
+            end = true;
+            *read_content = nullptr;
+          }
+          else
+            (*read_content)();
+        });
+      };
+      (*read_content)();
+    });
+    client.io_service->run();
+    assert(end);
+    assert(content == "Hello world");
+    assert(client.connections.size() == 1);
+
+    // Chunked response with a chunk extension and a trailer field
+    client.io_service->reset();
+    content.clear();
+    end = false;
+    client.request_stream("POST", "/chunked_trailer", "6;name=value\r\nSimple\r\n3\r\nWeb\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\nChecksum: abc\r\n\r\n", {{"Transfer-Encoding", "chunked"}}, [&](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      auto read_content = make_shared<function<void()>>();
+      *read_content = [&, response, read_content] {
+        response->read_content([&, response, read_content](const SimpleWeb::error_code &ec, bool end_) {
+          assert(!ec);
+          content += response->content.string();
+          if(end_) {
+            auto it = response->header.find("Checksum");
+            assert(it != response->header.end() && it->second == "def");
+            end = true;
+            *read_content = nullptr;
+          }
+          else
+            (*read_content)();
+        });
+      };
+      (*read_content)();
+    });
+    client.io_service->run();
+    assert(end);
+    assert(content == "SimpleWeb in\r\n\r\nchunks.");
+    assert(client.connections.size() == 1);
+    assert(client.connect_statistics().connects == 1);
+
+    // Response without content
+    client.io_service->reset();
+    end = false;
+    client.request_stream("HEAD", "/large", [&](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      assert(response->header.find("Content-Length")->second == "100000");
+      response->read_content([&](const SimpleWeb::error_code &ec, bool end_) {
+        assert(!ec && end_);
+        end = true;
+      });
+    });
+    client.io_service->run();
+    assert(end);
+  }
+
+  // Test batched requests
+  {
+    HttpClient client("localhost:8080");
+    vector<HttpClient::BatchRequest> requests;
+    for(size_t c = 0; c < 10; ++c)
+      requests.emplace_back("GET", "/match/" + to_string(c));
+    requests.emplace_back("POST", "/string", "A string");
+    bool called = false;
+    client.request_batch(requests, 3, [&called](vector<HttpClient::BatchResult> &&results) {
+      assert(!called);
+      called = true;
+      assert(results.size() == 11);
+      for(size_t c = 0; c < 10; ++c) {
+        assert(!results[c].ec);
+        assert(results[c].response->content.string() == to_string(c));
+      }
+      assert(results[10].response->content.string() == "A string");
+    });
+    client.io_service->run();
+    assert(called);
+    assert(client.connections.size() <= 3);
+
+    // Complete when the first 3 requests have succeeded
+    client.io_service->reset();
+    called = false;
+    client.request_batch(requests, 2, [&called](vector<HttpClient::BatchResult> &&results) {
+      assert(!called);
+      called = true;
+      size_t successes = 0, canceled = 0;
+      for(auto &result : results) {
+        if(!result.ec)
+          ++successes;
+        else if(result.ec == SimpleWeb::errc::operation_canceled)
+          ++canceled;
+      }
+      assert(successes == 3);
+      assert(canceled == 8);
+    }, 3);
+    client.io_service->run();
+    assert(called);
+  }
+
+  // Test request content from caller-owned buffers and from a file
+  {
+    HttpClient client("localhost:8080");
+    string part1 = "A ", part2 = "string";
+    bool called = false;
+    client.request_buffers("POST", "/string", {asio::buffer(part1), asio::buffer(part2)}, {}, [&called](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      assert(response->content.string() == "A string");
+      called = true;
+    });
+    client.io_service->run();
+    assert(called);
+
+    string file_content;
+    for(size_t c = 0; c < 2000000; ++c)
+      file_content += static_cast<char>('a' + c % 26);
+    string file_path = "io_test_upload.tmp";
+    {
+      ofstream file(file_path, ios::binary);
+      file << file_content;
+    }
+    client.io_service->reset();
+    vector<int> calls(3, 0);
+    client.request_file("POST", "/string", file_path, {}, [&calls, &file_content](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      assert(response->content.string() == file_content);
+      calls[0] = 1;
+    });
+    client.request_file("POST", "/string", "nonexistent.tmp", {}, [&calls](shared_ptr<HttpClient::Response> /*response*/, const SimpleWeb::error_code &ec) {
+      assert(ec);
+      calls[1] = 1;
+    });
+    client.request("POST", "/string", "After file", [&calls](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      assert(response->content.string() == "After file");
+      calls[2] = 1;
+    });
+    client.io_service->run();
+    for(auto call : calls)
+      assert(call);
+    remove(file_path.c_str());
+  }
+
+  // Test chunked request content from a producer
+  {
+    HttpClient client("localhost:8080");
+    string expected;
+    for(size_t c = 0; c < 100; ++c)
+      expected += "part " + to_string(c) + ' ';
+    size_t part = 0;
+    bool called = false;
+    client.request_chunked("POST", "/string", {}, [&part, &client](function<void(SimpleWeb::string_view)> send) {
+      if(part == 100) {
+        send("");
+        return;
+      }
+      auto content = "part " + to_string(part++) + ' ';
+      if(part % 10 == 0) // Send later
+        client.io_service->post([send, content] {
+          send(content);
+        });
+      else
+        send(content);
+    }, [&called, &expected](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      assert(response->content.string() == expected);
+      called = true;
+    });
+    client.io_service->run();
+    assert(called);
+    assert(part == 100);
+  }
+
+  // Test that chunked request content rejects conflicting framing header fields
+  {
+    HttpClient client("localhost:8080");
+    size_t calls = 0;
+    size_t produced = 0;
+    auto producer = [&produced](function<void(SimpleWeb::string_view)> send) {
+      ++produced;
+      send(produced % 2 == 1 ? "content" : "");
+    };
+    auto rejected = [&calls](shared_ptr<HttpClient::Response> /*response*/, const SimpleWeb::error_code &ec) {
+      assert(ec == SimpleWeb::errc::invalid_argument);
+      ++calls;
+    };
+    client.request_chunked("POST", "/string", {{"Content-Length", "7"}}, producer, rejected);
+    client.request_chunked("POST", "/string", {{"Transfer-Encoding", "chunked, gzip"}}, producer, rejected);
+    client.io_service->run();
+    assert(calls == 2);
+    assert(produced == 0);
+
+    client.io_service->reset();
+    bool called = false;
+    client.request_chunked("POST", "/string", {{"Transfer-Encoding", "chunked"}}, producer, [&called](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      assert(response->content.string() == "content");
+      called = true;
+    });
+    client.io_service->run();
+    assert(called);
+  }
+
+#ifdef HAVE_ZLIB
+  // Test decompression of responses
+  {
+    HttpClient client("localhost:8080");
+    client.config.accept_encoding = true;
+    auto response = client.request("GET", "/gzip");
+    assert(response->header.find("Content-Encoding") == response->header.end());
+    assert(response->content.string() == uncompressed_content());
+    response = client.request("GET", "/deflate");
+    assert(response->content.string() == uncompressed_content());
+    response = client.request("GET", "/deflate?raw");
+    assert(response->content.string() == uncompressed_content());
+    try {
+      client.request("GET", "/gzip?truncated");
+      assert(false);
+    }
+    catch(const SimpleWeb::system_error &e) {
+      assert(e.code() == SimpleWeb::errc::protocol_error);
+    }
+
+    string content;
+    bool end = false;
+    client.config.max_content_part_size = 100;
+    client.request_stream("GET", "/gzip", [&](shared_ptr<HttpClient::Response> response, const SimpleWeb::error_code &ec) {
+      assert(!ec);
+      auto read_content = make_shared<function<void()>>();
+      *read_content = [&, response, read_content] {
+        response->read_content([&, response, read_content](const SimpleWeb::error_code &ec, bool end_) {
+          assert(!ec);
+          content += response->content.string();
+          if(end_) {
+            end = true;
+            *read_content = nullptr;
+          }
+          else
+            (*read_content)();
+        });
+      };
+      (*read_content)();
+    });
+    client.io_service->reset();
+    client.io_service->run();
+    assert(end);
+    assert(content == uncompressed_content());
+
+    // The limit applies to the decompressed content
+    HttpClient client2("localhost:8080");
+    client2.config.accept_encoding = true;
+    client2.config.max_response_streambuf_size = uncompressed_content().size() / 2;
+    try {
+      client2.request("GET", "/gzip");
+      assert(false);
+    }
+    catch(const SimpleWeb::system_error &e) {
+      assert(e.code() == SimpleWeb::errc::message_size);
+    }
+
+    // Without accept_encoding, the content is not decompressed
+    HttpClient client3("localhost:8080");
+    response = client3.request("GET", "/gzip", "", {{"Accept-Encoding", "gzip, deflate"}});
+    assert(response->header.find("Content-Encoding")->second == "gzip");
+    assert(response->content.string() == compress(uncompressed_content(), 15 + 16));
+  }
+#endif
+
+  // Test requests from several threads through the client's io threads
+  {
+    HttpClient client("localhost:8080");
+    client.config.max_connections = 4;
+    client.start_io_threads(2);
+    atomic<int> calls(0);
+    vector<thread> threads;
+    for(size_t t = 0; t < 4; ++t) {
+      threads.emplace_back([&client, &calls, t] {
+        vector<future<shared_ptr<HttpClient::Response>>> responses;
+        for(size_t c = 0; c < 25; ++c)
+          responses.emplace_back(client.request_async("GET", "/match/" + to_string(t * 100 + c)));
+        for(size_t c = 0; c < 25; ++c) {
+          assert(responses[c].get()->content.string() == to_string(t * 100 + c));
+          ++calls;
+        }
+        auto response = client.request("POST", "/string", "A string");
+        assert(response->content.string() == "A string");
+        ++calls;
+      });
+    }
+    for(auto &thread : threads)
+      thread.join();
+    assert(calls == 104);
+    client.stop_io_threads();
+    assert(client.connections.size() <= 4);
+    assert(client.requests_in_flight == 0);
+
+    HttpClient client2("localhost:8089");
+    client2.start_io_threads();
+    try {
+      client2.request_async("GET", "/").get();
+      assert(false);
+    }
+    catch(const SimpleWeb::system_error &) {
+    }
+
+    // A synchronous request from an io thread would deadlock
+    promise<bool> thrown;
+    client.start_io_threads();
+    client.io_service->post([&client, &thrown] {
+      try {
+        client.request("GET", "/match/2");
+        thrown.set_value(false);
+      }
+      catch(const SimpleWeb::system_error &e) {
+        thrown.set_value(e.code() == SimpleWeb::errc::resource_deadlock_would_occur);
+      }
+    });
+    assert(thrown.get_future().get());
+
+    // An external io_service is run by the user's threads
+    HttpClient client3("localhost:8080");
+    client3.io_service = make_shared<asio::io_service>();
+    try {
+      client3.start_io_threads();
+      assert(false);
+    }
+    catch(const SimpleWeb::system_error &e) {
+      assert(e.code() == SimpleWeb::errc::operation_not_supported);
+    }
+    assert(!client3.io_threads_running());
+  }
+
   // Test concurrent synchronous request calls
   {
     HttpClient client("localhost:8080");
@@ -386,6 +1030,22 @@ int main() {
     assert(call);
   }
 
+  // Test Client client's stop() while resolving, before the io_service is run
+  {
+    auto io_service = make_shared<asio::io_service>();
+    bool call = false;
+    HttpClient client("localhost:8080");
+    client.io_service = io_service;
+    client.request("GET", "/work", [&call](shared_ptr<HttpClient::Response> /*response*/, const SimpleWeb::error_code &ec) {
+      assert(!call);
+      call = true;
+      assert(ec);
+    });
+    client.stop();
+    io_service->run();
+    assert(call);
+  }
+
   // Test Client destructor that should cancel the client's request
   for(size_t c = 0; c < 40; ++c) {
     auto io_service = make_shared<asio::io_service>();
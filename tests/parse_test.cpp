@@ -71,6 +71,18 @@ public:
     assert(port == 80);
   }
 
+  void interleave_address_families_test() {
+    auto ipv4_1 = asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"), 80);
+    auto ipv4_2 = asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.2"), 80);
+    auto ipv6_1 = asio::ip::tcp::endpoint(asio::ip::address::from_string("::1"), 80);
+    auto ipv6_2 = asio::ip::tcp::endpoint(asio::ip::address::from_string("::2"), 80);
+
+    assert(interleave_address_families({}).empty());
+    assert(interleave_address_families({ipv4_1, ipv4_2}) == std::vector<asio::ip::tcp::endpoint>({ipv4_1, ipv4_2}));
+    assert(interleave_address_families({ipv6_1, ipv6_2, ipv4_1, ipv4_2}) == std::vector<asio::ip::tcp::endpoint>({ipv6_1, ipv4_1, ipv6_2, ipv4_2}));
+    assert(interleave_address_families({ipv4_1, ipv6_1, ipv6_2}) == std::vector<asio::ip::tcp::endpoint>({ipv4_1, ipv6_1, ipv6_2}));
+  }
+
   void parse_response_header_test() {
     std::shared_ptr<Response> response(new Response(static_cast<size_t>(-1)));
 
@@ -146,6 +158,59 @@ int main() {
   auto fields_result2 = QueryString::parse(query_string2);
   assert(fields_result1 == fields_result2 && fields_result1 == fields);
 
+  {
+    string encoded;
+    for(int c = 0; c < 256; ++c)
+      encoded += static_cast<char>(c);
+    encoded += encoded + "unreserved-characters.only_~0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    for(size_t size = 0; size < encoded.size(); size += 7) {
+      auto value = encoded.substr(encoded.size() - size);
+      assert(Percent::decode(Percent::encode(value)) == value);
+    }
+    assert(Percent::decode("a+b%20c%2") == "a b c%2");
+    assert(Percent::decode("%zz%4g%%41") == "%zz%4g%A");
+    string value = "%41%42c+d%2Fe";
+    Percent::decode_in_place(value);
+    assert(value == "ABc d/e");
+  }
+
+  {
+    auto query_string = "test1=%C3%A6%C3%B8%C3%A5&Test2=a+b&test2=c&empty&=ignored&a=b=c&test3=";
+    QueryString::View view(query_string);
+    assert(view.get("test1") == "æøå");
+    assert(view.get("test2") == "a b");
+    assert(view.get_all("TEST2") == vector<string>({"a b", "c"}));
+    assert(view.contains("empty") && view.get("empty", "default").empty());
+    assert(view.contains("test3") && view.get("test3", "default").empty());
+    assert(!view.contains("missing") && view.get("missing", "default") == "default");
+    assert(!view.contains(""));
+    assert(view.get("a=b") == "c");
+    auto fields = QueryString::parse(query_string);
+    for(auto &field : fields)
+      assert(view.contains(field.first));
+    assert(view.get("a=b") == fields.find("a=b")->second);
+  }
+
+  {
+    char buffer[ToChars::max_decimal_size];
+    assert(string(buffer, ToChars::integer(buffer, 0)) == "0");
+    assert(string(buffer, ToChars::integer(buffer, 7)) == "7");
+    assert(string(buffer, ToChars::integer(buffer, 42)) == "42");
+    assert(string(buffer, ToChars::integer(buffer, 100)) == "100");
+    assert(string(buffer, ToChars::integer(buffer, -12345)) == "-12345");
+    assert(string(buffer, ToChars::integer(buffer, numeric_limits<long long>::min())) == "-9223372036854775808");
+    assert(string(buffer, ToChars::integer(buffer, numeric_limits<unsigned long long>::max())) == "18446744073709551615");
+    assert(string(buffer, ToChars::integer(buffer, static_cast<size_t>(1024))) == "1024");
+
+    assert(string(buffer, ToChars::decimal(buffer, 0.0)) == "0.000000");
+    assert(string(buffer, ToChars::decimal(buffer, 3.14159, 2)) == "3.14");
+    assert(string(buffer, ToChars::decimal(buffer, -2.5, 0)) == "-3");
+    assert(string(buffer, ToChars::decimal(buffer, 9.9999, 3)) == "10.000");
+    assert(string(buffer, ToChars::decimal(buffer, 0.05, 3)) == "0.050");
+    assert(string(buffer, ToChars::decimal(buffer, -0.25, 2)) == "-0.25");
+    assert(string(buffer, ToChars::decimal(buffer, 1e20, 2)) == "1e+20");
+  }
+
   auto serverTest = make_shared<ServerTest>();
   serverTest->io_service = std::make_shared<asio::io_service>();
 
@@ -159,6 +224,8 @@ int main() {
 
   clientTest2->parse_response_header_test();
 
+  clientTest2->interleave_address_families_test();
+
 
   asio::io_service io_service;
   asio::ip::tcp::socket socket(io_service);
@@ -298,4 +365,173 @@ int main() {
       }
     }
   }
+
+  {
+    auto arena = make_shared<SimpleWeb::Arena>(256);
+    auto first = arena->allocate(64, 8);
+    auto second = arena->allocate(32, 16);
+    assert(static_cast<char *>(second) == static_cast<char *>(first) + 64);
+    auto heap = arena->allocate(128, 8); // Does not fit in the rest of the current half
+    assert(heap != nullptr && (heap < first || heap >= static_cast<char *>(first) + 256));
+    arena->deallocate(heap);
+
+    arena->next();
+    auto other = arena->allocate(64, 8);
+    assert(other == static_cast<char *>(first) + 128);
+
+    arena->next(); // The first half is still in use
+    assert(arena->allocate(16, 8) == static_cast<char *>(other) + 64);
+
+    arena->deallocate(first);
+    arena->deallocate(second);
+    arena->next();
+    assert(arena->allocate(16, 8) == first);
+
+    vector<int, SimpleWeb::ArenaAllocator<int>> numbers{SimpleWeb::ArenaAllocator<int>(make_shared<SimpleWeb::Arena>(1024))};
+    for(int i = 0; i < 100; ++i)
+      numbers.emplace_back(i);
+    assert(numbers.size() == 100 && numbers[99] == 99);
+  }
+
+  {
+    string line(100, 'a');
+    auto data = line.data();
+    {
+      SimpleWeb::LineBufferGuard line_guard(line);
+    }
+    assert(line.data() == data); // Small buffers are kept
+
+    line.assign(SimpleWeb::LineBufferGuard::max_capacity + 1, 'a');
+    {
+      SimpleWeb::LineBufferGuard line_guard(line);
+    }
+    assert(line.empty() && line.capacity() <= SimpleWeb::LineBufferGuard::max_capacity);
+  }
+
+  {
+    SimpleWeb::HandlerMemory memory;
+    auto begin = reinterpret_cast<char *>(&memory);
+    auto end = begin + sizeof(memory);
+    auto in_memory = [begin, end](void *pointer) {
+      return static_cast<char *>(pointer) >= begin && static_cast<char *>(pointer) < end;
+    };
+    vector<void *> blocks;
+    for(size_t c = 0; c < SimpleWeb::HandlerMemory::block_count; ++c) {
+      blocks.emplace_back(memory.allocate(c == 0 ? SimpleWeb::HandlerMemory::block_size : 16));
+      assert(in_memory(blocks.back()));
+      assert(find(blocks.begin(), blocks.end() - 1, blocks.back()) == blocks.end() - 1);
+    }
+
+    auto heap = memory.allocate(16); // All blocks are in use
+    assert(!in_memory(heap));
+    memory.deallocate(heap);
+
+    memory.deallocate(blocks[1]);
+    auto large = memory.allocate(SimpleWeb::HandlerMemory::block_size + 1); // Larger than a block
+    assert(!in_memory(large));
+    memory.deallocate(large);
+    assert(memory.allocate(16) == blocks[1]); // Reused after deallocate()
+
+    for(auto &block : blocks)
+      memory.deallocate(block);
+    assert(memory.allocate(16) == blocks[0]);
+  }
+
+  {
+    assert(SimpleWeb::MultipartParser::boundary("multipart/form-data; boundary=abc") == "abc");
+    assert(SimpleWeb::MultipartParser::boundary("Multipart/Form-Data;boundary=\"a b;c\"") == "a b;c");
+    assert(SimpleWeb::MultipartParser::boundary("multipart/form-data; charset=utf-8; boundary=x+y; z=1") == "x+y");
+    assert(SimpleWeb::MultipartParser::boundary("text/plain; boundary=abc").empty());
+    assert(SimpleWeb::MultipartParser::boundary("multipart/form-data").empty());
+
+    string large(1000, 'x');
+    for(size_t c = 0; c < large.size(); c += 7)
+      large[c] = '\r';
+    string content = "preamble\r\n--boundary\r\nContent-Disposition: form-data; name=\"field\"\r\n\r\nvalue\r\n--boundar\r\n"
+                     "--boundary \t \r\nContent-Disposition: form-data; name=\"file\"; filename=\"file%20name.txt\"\r\nContent-Type: text/plain\r\n\r\n" +
+                     large + "\r\n--boundary\r\n\r\n\r\n--boundary--\r\nepilogue";
+    // Pass the content in pieces of every size
+    for(size_t piece_size = 1; piece_size <= content.size(); piece_size += piece_size < 100 ? 1 : 97) {
+      SimpleWeb::MultipartParser parser("boundary", 100);
+      for(size_t c = 0; c < content.size(); c += piece_size)
+        assert(parser.write(content.data() + c, min(piece_size, content.size() - c)));
+      assert(parser.finished());
+      assert(parser.parts.size() == 3);
+      assert(parser.parts[0].name == "field" && parser.parts[0].filename.empty() && !parser.parts[0].file);
+      assert(parser.parts[0].content == "value\r\n--boundar" && parser.parts[0].size == 16);
+      assert(parser.parts[1].name == "file" && parser.parts[1].filename == "file name.txt" && parser.parts[1].header.find("Content-Type")->second == "text/plain");
+      assert(parser.parts[1].content.empty() && parser.parts[1].size == large.size() && parser.parts[1].file);
+      string file_content(large.size(), '\0');
+      assert(fread(&file_content[0], 1, file_content.size(), parser.parts[1].file.get()) == large.size() && file_content == large);
+      assert(parser.parts[2].header.empty() && parser.parts[2].size == 0);
+    }
+    {
+      SimpleWeb::MultipartParser parser("boundary", 100, 999);
+      assert(!parser.write(content.data(), content.size()));
+      assert(parser.error() == SimpleWeb::MultipartParser::Error::part_too_large);
+    }
+    {
+      // The second part exceeds the total memory limit, and is written to a file although it is smaller than the memory limit
+      SimpleWeb::MultipartParser parser("boundary", 100, 999, 1024, 20);
+      string content = "--boundary\r\n\r\n0123456789\r\n--boundary\r\n\r\n0123456789x\r\n--boundary\r\n\r\n012\r\n--boundary--";
+      assert(parser.write(content.data(), content.size()) && parser.finished());
+      assert(parser.parts.size() == 3);
+      assert(parser.parts[0].content == "0123456789" && !parser.parts[0].file);
+      assert(parser.parts[1].content.empty() && parser.parts[1].size == 11 && parser.parts[1].file);
+      assert(parser.parts[2].content == "012" && !parser.parts[2].file);
+
+      SimpleWeb::MultipartParser parser2("boundary", 100, 999, 1024, 20, 2);
+      assert(!parser2.write(content.data(), content.size()));
+      assert(parser2.error() == SimpleWeb::MultipartParser::Error::too_many_parts && parser2.parts.size() == 2);
+    }
+    {
+      SimpleWeb::MultipartParser parser("boundary");
+      string content = "--boundary\r\n\r\nvalue\r\n--boundaryx\r\n";
+      assert(!parser.write(content.data(), content.size()));
+      assert(parser.error() == SimpleWeb::MultipartParser::Error::malformed);
+    }
+    {
+      SimpleWeb::MultipartParser parser("boundary");
+      string content = "--boundary\r\n\r\nvalue\r\n--boundary x\r\n";
+      assert(!parser.write(content.data(), content.size()));
+      assert(parser.error() == SimpleWeb::MultipartParser::Error::malformed);
+    }
+  }
+
+  {
+    string content = "6;name=\"value\"\r\nSimple\r\n3\r\nWeb\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\nChecksum: abc\r\n\r\nGET / HTTP/1.1\r\n";
+    auto end = content.find("GET");
+    // Decode pieces of every size in place
+    for(size_t piece_size = 1; piece_size <= content.size(); ++piece_size) {
+      SimpleWeb::ChunkedDecoder decoder;
+      auto buffer = content;
+      size_t decoded = 0, position = 0;
+      while(!decoder.complete()) {
+        assert(position < buffer.size());
+        auto size = min(piece_size, buffer.size() - position);
+        size_t consumed;
+        auto decoded_size = decoder.decode(&buffer[position], size, &buffer[decoded], consumed);
+        assert(decoder.error() == SimpleWeb::ChunkedDecoder::Error::none && (consumed == size || decoder.complete()));
+        decoded += decoded_size;
+        position += consumed;
+      }
+      assert(position == end);
+      assert(buffer.substr(0, decoded) == "SimpleWeb in\r\n\r\nchunks.");
+      assert(decoder.trailer.size() == 1 && decoder.trailer.find("checksum")->second == "abc");
+    }
+    for(auto &content : {"x\r\n", ";\r\n", "1\r\nab\r\n", "1\n", "11111111111111111\r\n"}) {
+      SimpleWeb::ChunkedDecoder decoder;
+      string buffer(content);
+      size_t consumed;
+      decoder.decode(buffer.data(), buffer.size(), &buffer[0], consumed);
+      assert(decoder.error() == SimpleWeb::ChunkedDecoder::Error::malformed);
+    }
+    {
+      SimpleWeb::ChunkedDecoder decoder(8, 16);
+      string buffer = "1;extension\r\n";
+      size_t consumed;
+      decoder.decode(buffer.data(), buffer.size(), &buffer[0], consumed);
+      assert(decoder.error() == SimpleWeb::ChunkedDecoder::Error::too_large);
+    }
+  }
 }
@@ -2,11 +2,42 @@
 #define SIMPLE_WEB_UTILITY_HPP
 
 #include "status_code.hpp"
+#include <algorithm>
 #include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMPLE_WEB_SSE2
+#include <emmintrin.h>
+#endif
+
+#if __cplusplus > 201402L || (defined(_MSC_VER) && _MSC_VER >= 1910)
+#include <string_view>
+namespace SimpleWeb {
+  using string_view = std::string_view;
+}
+#elif !defined(USE_STANDALONE_ASIO)
+#include <boost/utility/string_ref.hpp>
+namespace SimpleWeb {
+  using string_view = boost::string_ref;
+}
+#else
+namespace SimpleWeb {
+  using string_view = const std::string &;
+}
+#endif
 
 namespace SimpleWeb {
   inline bool case_insensitive_equal(const std::string &str1, const std::string &str2) noexcept {
@@ -40,41 +71,222 @@ namespace SimpleWeb {
   public:
     /// Returns percent-encoded string
     static std::string encode(const std::string &value) noexcept {
-      static auto hex_chars = "0123456789ABCDEF";
-
       std::string result;
-      result.reserve(value.size()); // Minimum size of result
+      result.resize(value.size() * 3); // Maximum size of result
+      result.resize(encode(value.data(), value.size(), &result[0]));
+      return result;
+    }
 
-      for(auto &chr : value) {
-        if(!((chr >= '0' && chr <= '9') || (chr >= 'A' && chr <= 'Z') || (chr >= 'a' && chr <= 'z') || chr == '-' || chr == '.' || chr == '_' || chr == '~'))
-          result += std::string("%") + hex_chars[static_cast<unsigned char>(chr) >> 4] + hex_chars[static_cast<unsigned char>(chr) & 15];
-        else
-          result += chr;
+    /// Writes percent-encoded value to output, which must hold 3 * size characters.
+    /// Returns number of characters written.
+    static std::size_t encode(const char *value, std::size_t size, char *output) noexcept {
+      static auto hex_chars = "0123456789ABCDEF";
+
+      auto out = output;
+      std::size_t i = 0;
+#ifdef SIMPLE_WEB_SSE2
+      // Copies blocks of 16 characters that need no encoding
+      for(; i + 16 <= size; i += 16) {
+        auto in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(value + i));
+        auto digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), in));
+        auto upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), in));
+        auto lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), in));
+        auto other = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('-')), _mm_cmpeq_epi8(in, _mm_set1_epi8('.'))),
+                                  _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('_')), _mm_cmpeq_epi8(in, _mm_set1_epi8('~'))));
+        if(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(digit, upper), _mm_or_si128(lower, other))) == 0xffff) {
+          _mm_storeu_si128(reinterpret_cast<__m128i *>(out), in);
+          out += 16;
+        }
+        else {
+          for(auto end = i + 16; i < end; ++i)
+            out = encode(value[i], out, hex_chars);
+          i -= 16;
+        }
       }
+#endif
+      for(; i < size; ++i)
+        out = encode(value[i], out, hex_chars);
 
-      return result;
+      return static_cast<std::size_t>(out - output);
     }
 
     /// Returns percent-decoded string
     static std::string decode(const std::string &value) noexcept {
       std::string result;
-      result.reserve(value.size() / 3 + (value.size() % 3)); // Minimum size of result
-
-      for(std::size_t i = 0; i < value.size(); ++i) {
-        auto &chr = value[i];
-        if(chr == '%' && i + 2 < value.size()) {
-          auto hex = value.substr(i + 1, 2);
-          auto decoded_chr = static_cast<char>(std::strtol(hex.c_str(), nullptr, 16));
-          result += decoded_chr;
-          i += 2;
+      result.resize(value.size()); // Maximum size of result
+      result.resize(decode(value.data(), value.size(), &result[0]));
+      return result;
+    }
+
+    /// Percent-decodes value in place.
+    static void decode_in_place(std::string &value) noexcept {
+      if(!value.empty())
+        value.resize(decode(&value[0], value.size(), &value[0]));
+    }
+
+    /// Writes percent-decoded value to output, which must hold size characters, and can be equal to value.
+    /// Returns number of characters written. Invalid escape sequences are kept as is.
+    static std::size_t decode(const char *value, std::size_t size, char *output) noexcept {
+      auto out = output;
+      std::size_t i = 0;
+      while(i < size) {
+#ifdef SIMPLE_WEB_SSE2
+        // Copies blocks of 16 characters without '%' or '+'
+        if(i + 16 <= size) {
+          auto in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(value + i));
+          if(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('%')), _mm_cmpeq_epi8(in, _mm_set1_epi8('+')))) == 0) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), in);
+            out += 16;
+            i += 16;
+            continue;
+          }
+        }
+#endif
+        auto chr = value[i];
+        int high, low;
+        if(chr == '%' && i + 2 < size && (high = hex_value(value[i + 1])) >= 0 && (low = hex_value(value[i + 2])) >= 0) {
+          *out++ = static_cast<char>(high << 4 | low);
+          i += 3;
+        }
+        else {
+          *out++ = chr == '+' ? ' ' : chr;
+          ++i;
         }
-        else if(chr == '+')
-          result += ' ';
-        else
-          result += chr;
       }
 
-      return result;
+      return static_cast<std::size_t>(out - output);
+    }
+
+  private:
+    static char *encode(char chr, char *out, const char *hex_chars) noexcept {
+      if(!((chr >= '0' && chr <= '9') || (chr >= 'A' && chr <= 'Z') || (chr >= 'a' && chr <= 'z') || chr == '-' || chr == '.' || chr == '_' || chr == '~')) {
+        *out++ = '%';
+        *out++ = hex_chars[static_cast<unsigned char>(chr) >> 4];
+        *out++ = hex_chars[static_cast<unsigned char>(chr) & 15];
+      }
+      else
+        *out++ = chr;
+      return out;
+    }
+
+    static int hex_value(char chr) noexcept {
+      if(chr >= '0' && chr <= '9')
+        return chr - '0';
+      if(chr >= 'A' && chr <= 'F')
+        return chr - 'A' + 10;
+      if(chr >= 'a' && chr <= 'f')
+        return chr - 'a' + 10;
+      return -1;
+    }
+  };
+
+  /// Locale independent number to characters conversion, similar to C++17's std::to_chars
+  class ToChars {
+    static const char *digit_pairs() noexcept {
+      return "00010203040506070809"
+             "10111213141516171819"
+             "20212223242526272829"
+             "30313233343536373839"
+             "40414243444546474849"
+             "50515253545556575859"
+             "60616263646566676869"
+             "70717273747576777879"
+             "80818283848586878889"
+             "90919293949596979899";
+    }
+
+    static std::size_t unsigned_integer(char *buffer, unsigned long long value) noexcept {
+      char tmp[max_integer_size];
+      auto end = tmp + max_integer_size;
+      auto it = end;
+      while(value >= 100) {
+        auto pair = digit_pairs() + (value % 100) * 2;
+        value /= 100;
+        *--it = pair[1];
+        *--it = pair[0];
+      }
+      if(value >= 10) {
+        auto pair = digit_pairs() + value * 2;
+        *--it = pair[1];
+        *--it = pair[0];
+      }
+      else
+        *--it = static_cast<char>('0' + value);
+      auto size = static_cast<std::size_t>(end - it);
+      std::memcpy(buffer, it, size);
+      return size;
+    }
+
+    template <typename integer_type>
+    static std::size_t integer(char *buffer, integer_type value, std::true_type /*is_signed*/) noexcept {
+      if(value < 0) {
+        *buffer = '-';
+        return 1 + unsigned_integer(buffer + 1, 0ULL - static_cast<unsigned long long>(value));
+      }
+      return unsigned_integer(buffer, static_cast<unsigned long long>(value));
+    }
+
+    template <typename integer_type>
+    static std::size_t integer(char *buffer, integer_type value, std::false_type /*is_signed*/) noexcept {
+      return unsigned_integer(buffer, static_cast<unsigned long long>(value));
+    }
+
+  public:
+    /// Buffer size that is always sufficient for integer().
+    static constexpr std::size_t max_integer_size = 21;
+    /// Buffer size that is always sufficient for decimal().
+    static constexpr std::size_t max_decimal_size = 40;
+    /// Maximum number of decimals written by decimal().
+    static constexpr unsigned max_decimal_precision = 17;
+
+    /// Writes value in base 10 to buffer, which must hold at least max_integer_size characters.
+    /// Returns number of characters written.
+    template <typename integer_type>
+    static std::size_t integer(char *buffer, integer_type value) noexcept {
+      static_assert(std::is_integral<integer_type>::value, "integer_type must be an integral type");
+      return integer(buffer, value, std::is_signed<integer_type>());
+    }
+
+    /// Writes value in fixed notation with the given number of decimals to buffer, which must hold at
+    /// least max_decimal_size characters. Very large and non-finite values are written using printf's %g notation.
+    /// Returns number of characters written.
+    static std::size_t decimal(char *buffer, double value, unsigned precision = 6) noexcept {
+      if(precision > max_decimal_precision)
+        precision = max_decimal_precision;
+
+      if(!(std::fabs(value) < 1e15)) {
+        auto size = std::snprintf(buffer, max_decimal_size, "%.17g", value);
+        return size > 0 ? static_cast<std::size_t>(size) : 0;
+      }
+
+      std::size_t size = 0;
+      if(value < 0.0) {
+        buffer[size++] = '-';
+        value = -value;
+      }
+
+      unsigned long long scale = 1;
+      for(unsigned c = 0; c < precision; ++c)
+        scale *= 10;
+
+      auto integral = std::floor(value);
+      auto integral_part = static_cast<unsigned long long>(integral);
+      auto fractional_part = static_cast<unsigned long long>(std::round((value - integral) * static_cast<double>(scale)));
+      if(fractional_part >= scale) {
+        ++integral_part;
+        fractional_part -= scale;
+      }
+
+      size += unsigned_integer(buffer + size, integral_part);
+      if(precision > 0) {
+        buffer[size++] = '.';
+        for(auto c = size + precision; c > size;) {
+          buffer[--c] = static_cast<char>('0' + fractional_part % 10);
+          fractional_part /= 10;
+        }
+        size += precision;
+      }
+      return size;
     }
   };
 
@@ -109,7 +321,8 @@ namespace SimpleWeb {
           auto name = query_string.substr(name_pos, (name_end_pos == std::string::npos ? c : name_end_pos) - name_pos);
           if(!name.empty()) {
             auto value = value_pos == std::string::npos ? std::string() : query_string.substr(value_pos, c - value_pos);
-            result.emplace(std::move(name), Percent::decode(value));
+            Percent::decode_in_place(value);
+            result.emplace(std::move(name), std::move(value));
           }
           name_pos = c + 1;
           name_end_pos = std::string::npos;
@@ -124,12 +337,112 @@ namespace SimpleWeb {
         auto name = query_string.substr(name_pos, name_end_pos - name_pos);
         if(!name.empty()) {
           auto value = value_pos >= query_string.size() ? std::string() : query_string.substr(value_pos);
-          result.emplace(std::move(name), Percent::decode(value));
+          Percent::decode_in_place(value);
+          result.emplace(std::move(name), std::move(value));
         }
       }
 
       return result;
     }
+
+    /// Lazily parsed query string, where only the values that are looked up are percent-decoded.
+    /// Field names are matched case-insensitively as in parse(). The query string must outlive the view.
+    class View {
+    public:
+      View(const std::string &query_string) noexcept : View(query_string.data(), query_string.size()) {}
+      View(std::string &&) = delete;
+      View(const char *query_string) noexcept : View(query_string, std::strlen(query_string)) {}
+      View(const char *data, std::size_t size) noexcept : data(data), size(size) {}
+
+      /// Returns true if a field with the given name exists.
+      bool contains(const std::string &name) const noexcept {
+        bool found = false;
+        find(name, [&found](const char *, std::size_t) {
+          found = true;
+          return false;
+        });
+        return found;
+      }
+
+      /// Returns the percent-decoded value of the first field with the given name, or default_value if not found.
+      std::string get(const std::string &name, const std::string &default_value = std::string()) const noexcept {
+        std::string result;
+        bool found = false;
+        find(name, [&result, &found](const char *value, std::size_t value_size) {
+          result = decoded(value, value_size);
+          found = true;
+          return false;
+        });
+        return found ? result : default_value;
+      }
+
+      /// Returns the percent-decoded values of all fields with the given name.
+      std::vector<std::string> get_all(const std::string &name) const noexcept {
+        std::vector<std::string> result;
+        find(name, [&result](const char *value, std::size_t value_size) {
+          result.emplace_back(decoded(value, value_size));
+          return true;
+        });
+        return result;
+      }
+
+    private:
+      const char *data;
+      std::size_t size;
+
+      static std::string decoded(const char *value, std::size_t value_size) noexcept {
+        std::string result;
+        result.resize(value_size);
+        result.resize(Percent::decode(value, value_size, &result[0]));
+        return result;
+      }
+
+      /// Calls function(value, value_size) for each field with the given name until function returns false.
+      template <class Function>
+      void find(const std::string &name, const Function &function) const noexcept {
+        auto end = data + size;
+        for(auto field = data; field < end;) {
+          auto field_end = static_cast<const char *>(std::memchr(field, '&', static_cast<std::size_t>(end - field)));
+          if(!field_end)
+            field_end = end;
+
+          // As in parse(), the name ends at the last '='
+          auto value = field_end;
+          while(value > field && *(value - 1) != '=')
+            --value;
+          auto name_end = value > field ? value - 1 : field_end;
+          if(value == field)
+            value = field_end;
+
+          if(name_end > field && static_cast<std::size_t>(name_end - field) == name.size() &&
+             std::equal(field, name_end, name.begin(), [](char a, char b) {
+               return tolower(a) == tolower(b);
+             })) {
+            if(!function(value, static_cast<std::size_t>(field_end - value)))
+              return;
+          }
+          field = field_end + 1;
+        }
+      }
+    };
+  };
+
+  /// Releases the memory of a reused line buffer when it goes out of scope, if a long line has grown the buffer beyond
+  /// max_capacity. Otherwise a single long line would keep that memory for the lifetime of the thread.
+  class LineBufferGuard {
+    std::string &line;
+
+  public:
+    static const std::size_t max_capacity = 8192;
+
+    explicit LineBufferGuard(std::string &line) noexcept : line(line) {}
+    LineBufferGuard(const LineBufferGuard &) = delete;
+    LineBufferGuard &operator=(const LineBufferGuard &) = delete;
+
+    ~LineBufferGuard() noexcept {
+      if(line.capacity() > max_capacity)
+        std::string().swap(line);
+    }
   };
 
   class HttpHeader {
@@ -137,7 +450,8 @@ namespace SimpleWeb {
     /// Parse header fields
     static CaseInsensitiveMultimap parse(std::istream &stream) noexcept {
       CaseInsensitiveMultimap result;
-      std::string line;
+      thread_local std::string line; // Reuses its capacity from previous header fields
+      LineBufferGuard line_guard(line);
       getline(stream, line);
       std::size_t param_end;
       while((param_end = line.find(':')) != std::string::npos) {
@@ -210,12 +524,449 @@ namespace SimpleWeb {
     };
   }; // namespace SimpleWeb
 
+  /// Streaming parser of multipart/form-data content (RFC 7578), that is given the content in pieces as they are received.
+  /// Parts of at most memory_limit bytes are kept in memory, while the content of larger parts is written to temporary
+  /// files as it arrives.
+  class MultipartParser {
+  public:
+    class Part {
+    public:
+      /// Header fields of the part.
+      CaseInsensitiveMultimap header;
+      /// The name and filename attributes of the Content-Disposition header field.
+      std::string name, filename;
+      /// Size of the part content.
+      std::size_t size = 0;
+      /// Content of the part, if it was kept in memory.
+      std::string content;
+      /// Temporary file holding the content of the part, if it was larger than the memory limit.
+      /// The file is positioned at the start of the content, and is removed when it is closed.
+      std::shared_ptr<std::FILE> file;
+    };
+
+    enum class Error { none, malformed, part_too_large, too_many_parts, temporary_file };
+
+    /// Returns the boundary parameter of a multipart/form-data Content-Type header field value, or an empty string if the
+    /// value is not multipart/form-data or has no valid boundary.
+    static std::string boundary(const std::string &content_type) {
+      static const std::string media_type = "multipart/form-data";
+      if(content_type.size() < media_type.size() || !case_insensitive_equal(content_type.substr(0, media_type.size()), media_type))
+        return std::string();
+      for(auto pos = content_type.find(';', media_type.size()); pos != std::string::npos; pos = content_type.find(';', pos)) {
+        ++pos;
+        while(pos < content_type.size() && content_type[pos] == ' ')
+          ++pos;
+        if(content_type.size() - pos > 9 && case_insensitive_equal(content_type.substr(pos, 9), "boundary=")) {
+          pos += 9;
+          std::string result;
+          if(content_type[pos] == '"') {
+            auto end = content_type.find('"', pos + 1);
+            if(end != std::string::npos)
+              result = content_type.substr(pos + 1, end - pos - 1);
+          }
+          else
+            result = content_type.substr(pos, content_type.find(';', pos) - pos);
+          while(!result.empty() && result.back() == ' ')
+            result.pop_back();
+          return result.size() <= 70 ? result : std::string();
+        }
+      }
+      return std::string();
+    }
+
+    /// Parts that are larger than memory_limit are written to temporary files, and parts larger than max_part_size are rejected.
+    /// Parts are also written to temporary files once the content kept in memory by all parts would exceed total_memory_limit,
+    /// and content with more than max_parts parts is rejected.
+    MultipartParser(const std::string &boundary, std::size_t memory_limit = 64 * 1024, std::size_t max_part_size = std::numeric_limits<std::size_t>::max(),
+                    std::size_t max_header_size = 8 * 1024, std::size_t total_memory_limit = 1024 * 1024, std::size_t max_parts = 1000)
+        : delimiter("\r\n--" + boundary), memory_limit(memory_limit), max_part_size(max_part_size), max_header_size(max_header_size),
+          total_memory_limit(total_memory_limit), max_parts(max_parts), buffer("\r\n") {} // The first boundary delimiter is not preceded by a line break
+
+    /// The parts that have been parsed so far. The last part can be incomplete until finished() returns true.
+    std::vector<Part> parts;
+
+    /// Parses the next piece of the content. Returns false if the content is malformed or a part could not be stored, see error().
+    /// Bytes that could start a boundary delimiter are kept until the next call.
+    bool write(const char *data, std::size_t size) noexcept {
+      while(!buffer.empty() && size > 0 && error_ == Error::none) {
+        // A boundary delimiter can span the kept bytes and the next delimiter.size() bytes
+        auto count = std::min(size, delimiter.size());
+        buffer.append(data, count);
+        data += count;
+        size -= count;
+        buffer.erase(0, consume(buffer.data(), buffer.size()));
+      }
+      if(size > 0 && error_ == Error::none) {
+        auto consumed = consume(data, size);
+        buffer.assign(data + consumed, size - consumed);
+      }
+      return error_ == Error::none;
+    }
+
+    /// Returns true when the closing boundary delimiter has been parsed.
+    bool finished() const noexcept {
+      return state == State::epilogue;
+    }
+
+    Error error() const noexcept {
+      return error_;
+    }
+
+  private:
+    enum class State { preamble, delimiter_end, transport_padding, header, content, epilogue };
+
+    std::string delimiter;
+    std::size_t memory_limit, max_part_size, max_header_size, total_memory_limit, max_parts;
+    /// Size of the part content kept in memory
+    std::size_t memory_size = 0;
+    State state = State::preamble;
+    Error error_ = Error::none;
+    /// Bytes from the previous write() that could not be parsed yet
+    std::string buffer;
+    /// Header of the current part, starting with the line break that ended the boundary delimiter
+    std::string header_buffer;
+
+    /// Returns the number of parsed bytes.
+    std::size_t consume(const char *data, std::size_t size) noexcept {
+      std::size_t position = 0;
+      while(position < size && error_ == Error::none) {
+        if(state == State::preamble || state == State::content) {
+          auto begin = data + position, end = data + size;
+          auto match = find_delimiter(begin, end);
+          if(match == end) {
+            // Keep bytes at the end that start a boundary delimiter
+            auto keep = end - std::min(static_cast<std::size_t>(end - begin), delimiter.size() - 1);
+            while((keep = std::find(keep, end, '\r')) != end && std::memcmp(keep, delimiter.data(), static_cast<std::size_t>(end - keep)) != 0)
+              ++keep;
+            if(state == State::content && !add_content(begin, static_cast<std::size_t>(keep - begin)))
+              break;
+            return static_cast<std::size_t>(keep - data);
+          }
+          if(state == State::content) {
+            if(!add_content(begin, static_cast<std::size_t>(match - begin)) || !end_part())
+              break;
+          }
+          position = static_cast<std::size_t>(match - data) + delimiter.size();
+          state = State::delimiter_end;
+        }
+        else if(state == State::delimiter_end) {
+          if(size - position < 2)
+            return position;
+          if(data[position] == '-' && data[position + 1] == '-') {
+            state = State::epilogue;
+            position += 2;
+          }
+          else
+            state = State::transport_padding;
+        }
+        else if(state == State::transport_padding) {
+          // Linear whitespace is allowed between the boundary delimiter and its line break (RFC 2046 section 5.1.1)
+          while(position < size && (data[position] == ' ' || data[position] == '\t'))
+            ++position;
+          if(size - position < 2)
+            return position;
+          if(data[position] == '\r' && data[position + 1] == '\n') {
+            header_buffer.assign("\r\n");
+            state = State::header;
+          }
+          else
+            error_ = Error::malformed;
+          position += 2;
+        }
+        else if(state == State::header) {
+          auto previous_size = header_buffer.size();
+          header_buffer.append(data + position, std::min(size - position, max_header_size + 4 - previous_size));
+          auto header_end = header_buffer.find("\r\n\r\n", previous_size < 3 ? 0 : previous_size - 3);
+          if(header_end == std::string::npos) {
+            if(header_buffer.size() == max_header_size + 4)
+              error_ = Error::malformed;
+            position += header_buffer.size() - previous_size;
+            continue;
+          }
+          position += header_end + 4 - previous_size;
+          header_buffer.resize(header_end + 2);
+          if(!begin_part())
+            break;
+          state = State::content;
+        }
+        else // Content after the closing boundary delimiter is ignored
+          return size;
+      }
+      return position;
+    }
+
+    /// Returns the start of the first boundary delimiter in [begin, end), or end if not found.
+    const char *find_delimiter(const char *begin, const char *end) const noexcept {
+      auto size = delimiter.size();
+      if(static_cast<std::size_t>(end - begin) < size)
+        return end;
+      auto last = end - size; // Last position where a delimiter can start
+      auto it = begin;
+#ifdef SIMPLE_WEB_SSE2
+      // Compares the first and last characters of the delimiter with 16 positions at a time
+      auto first_chars = _mm_set1_epi8('\r');
+      auto last_chars = _mm_set1_epi8(delimiter.back());
+      for(; it + 16 <= last + 1; it += 16) {
+        auto mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(it)), first_chars),
+                                                    _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(it + size - 1)), last_chars)));
+        for(int c = 0; mask != 0; ++c, mask >>= 1) {
+          if((mask & 1) && std::memcmp(it + c + 1, delimiter.data() + 1, size - 2) == 0)
+            return it + c;
+        }
+      }
+#endif
+      for(; it <= last; ++it) {
+        it = static_cast<const char *>(std::memchr(it, '\r', static_cast<std::size_t>(last + 1 - it)));
+        if(!it)
+          return end;
+        if(std::memcmp(it, delimiter.data(), size) == 0)
+          return it;
+      }
+      return end;
+    }
+
+    bool begin_part() {
+      if(parts.size() == max_parts) {
+        error_ = Error::too_many_parts;
+        return false;
+      }
+      parts.emplace_back();
+      auto &part = parts.back();
+      std::istringstream stream(header_buffer.substr(2));
+      part.header = HttpHeader::parse(stream);
+      auto it = part.header.find("Content-Disposition");
+      if(it != part.header.end()) {
+        auto attributes = HttpHeader::FieldValue::SemicolonSeparatedAttributes::parse(it->second);
+        auto attribute = attributes.find("name");
+        if(attribute != attributes.end())
+          part.name = attribute->second;
+        attribute = attributes.find("filename");
+        if(attribute != attributes.end())
+          part.filename = attribute->second;
+      }
+      return true;
+    }
+
+    bool add_content(const char *data, std::size_t size) {
+      auto &part = parts.back();
+      if(size > max_part_size - part.size) {
+        error_ = Error::part_too_large;
+        return false;
+      }
+      part.size += size;
+      if(!part.file) {
+        if(part.size <= memory_limit && size <= total_memory_limit - memory_size) {
+          part.content.append(data, size);
+          memory_size += size;
+          return true;
+        }
+        auto file = std::tmpfile();
+        if(!file) {
+          error_ = Error::temporary_file;
+          return false;
+        }
+        part.file = std::shared_ptr<std::FILE>(file, std::fclose);
+        if(std::fwrite(part.content.data(), 1, part.content.size(), file) != part.content.size()) {
+          error_ = Error::temporary_file;
+          return false;
+        }
+        memory_size -= part.content.size();
+        std::string().swap(part.content);
+      }
+      if(std::fwrite(data, 1, size, part.file.get()) != size) {
+        error_ = Error::temporary_file;
+        return false;
+      }
+      return true;
+    }
+
+    bool end_part() {
+      auto &file = parts.back().file;
+      if(file && (std::fflush(file.get()) != 0 || std::fseek(file.get(), 0, SEEK_SET) != 0)) {
+        error_ = Error::temporary_file;
+        return false;
+      }
+      return true;
+    }
+  };
+
+  /// Input stream buffer that reads a given number of bytes from the current position of a file.
+  class FileStreambuf : public std::streambuf {
+  public:
+    FileStreambuf(std::shared_ptr<std::FILE> file, std::size_t size) noexcept : file(std::move(file)), remaining(size) {}
+
+    /// Returns the number of bytes that have not yet been read.
+    std::size_t size() const noexcept {
+      return remaining + static_cast<std::size_t>(egptr() - gptr());
+    }
+
+  protected:
+    int_type underflow() override {
+      if(gptr() == egptr()) {
+        auto count = std::fread(buffer, 1, std::min(sizeof(buffer), remaining), file.get());
+        if(count == 0)
+          return traits_type::eof();
+        remaining -= count;
+        setg(buffer, buffer, buffer + count);
+      }
+      return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize showmanyc() override {
+      return static_cast<std::streamsize>(remaining);
+    }
+
+    /// Larger reads bypass the buffer.
+    std::streamsize xsgetn(char *data, std::streamsize count) override {
+      auto buffered = std::min<std::streamsize>(count, egptr() - gptr());
+      if(buffered > 0) {
+        std::memcpy(data, gptr(), static_cast<std::size_t>(buffered));
+        gbump(static_cast<int>(buffered));
+      }
+      if(buffered == count)
+        return count;
+      auto read = std::fread(data + buffered, 1, std::min(static_cast<std::size_t>(count - buffered), remaining), file.get());
+      remaining -= read;
+      return buffered + static_cast<std::streamsize>(read);
+    }
+
+  private:
+    std::shared_ptr<std::FILE> file;
+    std::size_t remaining;
+    char buffer[4096];
+  };
+
+  /// Incremental decoder of the chunked transfer coding, that removes chunk size lines, chunk extensions and trailer fields
+  /// from the received bytes in a single pass. The decoded content can be written over the received bytes, that is, decoded in place.
+  class ChunkedDecoder {
+  public:
+    enum class Error { none, malformed, too_large };
+
+    /// Chunk size lines, including chunk extensions, longer than max_line_size and trailer sections larger than max_trailer_size
+    /// result in Error::too_large.
+    ChunkedDecoder(std::size_t max_line_size = 4096, std::size_t max_trailer_size = 8192) noexcept
+        : max_line_size(max_line_size), max_trailer_size(max_trailer_size) {}
+
+    /// Trailer fields, parsed when the message is complete.
+    CaseInsensitiveMultimap trailer;
+
+    /// Decodes the given bytes, and writes the chunk data to output, which can be the same as data.
+    /// Returns the number of bytes written to output, which is never more than the number of bytes used from data.
+    /// The number of bytes used is stored in consumed, which is less than size only when the message is complete,
+    /// in which case the remaining bytes belong to the next message.
+    std::size_t decode(const char *data, std::size_t size, char *output, std::size_t &consumed) noexcept {
+      auto in = data, end = data + size;
+      auto out = output;
+      while(in != end && state != State::complete && error_ == Error::none) {
+        switch(state) {
+        case State::size: {
+          auto chr = *in++;
+          int digit = chr >= '0' && chr <= '9' ? chr - '0' : chr >= 'a' && chr <= 'f' ? chr - 'a' + 10 : chr >= 'A' && chr <= 'F' ? chr - 'A' + 10 : -1;
+          if(digit >= 0 && remaining <= (std::numeric_limits<unsigned long long>::max() >> 4))
+            remaining = remaining << 4 | static_cast<unsigned long long>(digit);
+          else if(digit >= 0 || line_size == 0)
+            error_ = Error::malformed;
+          else if(chr == '\r')
+            state = State::size_end;
+          else if(chr == ';' || chr == ' ' || chr == '\t')
+            state = State::extension;
+          else
+            error_ = Error::malformed;
+          if(++line_size > max_line_size)
+            error_ = Error::too_large;
+          break;
+        }
+        case State::extension: { // Chunk extensions are ignored
+          auto line_end = static_cast<const char *>(std::memchr(in, '\r', static_cast<std::size_t>(end - in)));
+          auto next = line_end ? line_end + 1 : end;
+          line_size += static_cast<std::size_t>(next - in);
+          if(line_size > max_line_size)
+            error_ = Error::too_large;
+          else if(line_end)
+            state = State::size_end;
+          in = next;
+          break;
+        }
+        case State::size_end:
+          if(*in++ != '\n')
+            error_ = Error::malformed;
+          else {
+            line_size = 0;
+            state = remaining > 0 ? State::data : State::trailer;
+          }
+          break;
+        case State::data: {
+          auto count = static_cast<std::size_t>(std::min<unsigned long long>(remaining, static_cast<unsigned long long>(end - in)));
+          if(out != in)
+            std::memmove(out, in, count);
+          out += count;
+          in += count;
+          remaining -= count;
+          if(remaining == 0)
+            state = State::data_end;
+          break;
+        }
+        case State::data_end:
+          if(*in++ != (line_size == 0 ? '\r' : '\n'))
+            error_ = Error::malformed;
+          else if(++line_size == 2) {
+            line_size = 0;
+            state = State::size;
+          }
+          break;
+        case State::trailer: {
+          auto chr = *in++;
+          trailer_buffer += chr;
+          if(trailer_buffer.size() > max_trailer_size)
+            error_ = Error::too_large;
+          else if(chr == '\n') {
+            if(trailer_buffer.size() - line_size <= 2) { // Empty line
+              std::istringstream stream(trailer_buffer);
+              trailer = HttpHeader::parse(stream);
+              state = State::complete;
+            }
+            line_size = trailer_buffer.size();
+          }
+          break;
+        }
+        case State::complete:
+          break;
+        }
+      }
+      consumed = static_cast<std::size_t>(in - data);
+      return static_cast<std::size_t>(out - output);
+    }
+
+    /// Returns true when the last chunk and the trailer section have been decoded.
+    bool complete() const noexcept {
+      return state == State::complete;
+    }
+
+    Error error() const noexcept {
+      return error_;
+    }
+
+  private:
+    enum class State { size, extension, size_end, data, data_end, trailer, complete };
+
+    std::size_t max_line_size, max_trailer_size;
+    State state = State::size;
+    Error error_ = Error::none;
+    /// Size of the current chunk, or the remaining bytes of its data
+    unsigned long long remaining = 0;
+    /// Size of the current chunk size line, the number of line break characters read after chunk data, or the start of the
+    /// current trailer line
+    std::size_t line_size = 0;
+    std::string trailer_buffer;
+  };
+
   class RequestMessage {
   public:
     /// Parse request line and header fields
     static bool parse(std::istream &stream, std::string &method, std::string &path, std::string &query_string, std::string &version, CaseInsensitiveMultimap &header) noexcept {
       header.clear();
-      std::string line;
+      thread_local std::string line; // Reuses its capacity from previous requests
+      LineBufferGuard line_guard(line);
       getline(stream, line);
       std::size_t method_end;
       if((method_end = line.find(' ')) != std::string::npos) {
@@ -306,46 +1057,300 @@ namespace SimpleWeb {
 namespace SimpleWeb {
   /// Makes it possible to for instance cancel Asio handlers without stopping asio::io_service
   class ScopeRunner {
-    /// Scope count that is set to -1 if scopes are to be canceled
-    std::atomic<long> count;
+    /// Number of counters that the scope count is spread over, to avoid that all threads update the same cache line
+    static const std::size_t stripe_count = 16;
+
+    /// Padded on both ends, since the stripes are not aligned to cache lines (over-aligned new requires C++17).
+    /// Each count is then at least 64 bytes from other data, and on a cache line of its own.
+    class Stripe {
+    public:
+      char padding_front[64];
+      std::atomic<long> count;
+      char padding_back[64 - sizeof(std::atomic<long>)];
+    };
+
+    Stripe stripes[stripe_count];
+    /// Set if scopes are to be canceled
+    std::atomic<bool> stopped;
+
+    /// Each thread uses the same stripe
+    static std::size_t thread_stripe() noexcept {
+      static std::atomic<std::size_t> next_stripe(0);
+      thread_local std::size_t stripe = next_stripe++ % stripe_count;
+      return stripe;
+    }
 
   public:
     class SharedLock {
       friend class ScopeRunner;
-      std::atomic<long> &count;
-      SharedLock(std::atomic<long> &count) noexcept : count(count) {}
+      std::atomic<long> *count;
+      SharedLock(std::atomic<long> *count) noexcept : count(count) {}
+
+    public:
+      SharedLock(SharedLock &&other) noexcept : count(other.count) {
+        other.count = nullptr;
+      }
       SharedLock &operator=(const SharedLock &) = delete;
       SharedLock(const SharedLock &) = delete;
 
-    public:
       ~SharedLock() noexcept {
-        count.fetch_sub(1);
+        if(count)
+          count->fetch_sub(1);
       }
-    };
 
-    ScopeRunner() noexcept : count(0) {}
+      /// Returns false if scope should be exited
+      explicit operator bool() const noexcept {
+        return count != nullptr;
+      }
+    };
 
-    /// Returns nullptr if scope should be exited, or a shared lock otherwise
-    std::unique_ptr<SharedLock> continue_lock() noexcept {
-      long expected = count;
-      while(expected >= 0 && !count.compare_exchange_weak(expected, expected + 1))
-        spin_loop_pause();
+    ScopeRunner() noexcept : stopped(false) {
+      for(auto &stripe : stripes)
+        stripe.count = 0;
+    }
 
-      if(expected < 0)
-        return nullptr;
-      else
-        return std::unique_ptr<SharedLock>(new SharedLock(count));
+    /// Returns a lock that is false if scope should be exited
+    SharedLock continue_lock() noexcept {
+      auto &count = stripes[thread_stripe()].count;
+      count.fetch_add(1);
+      // Sequentially consistent with stop(): either stop() sees the incremented count, or this sees stopped
+      if(stopped) {
+        count.fetch_sub(1);
+        return SharedLock(nullptr);
+      }
+      return SharedLock(&count);
     }
 
-    /// Blocks until all shared locks are released, then prevents future shared locks
+    /// Prevents future shared locks, and blocks until all shared locks are released
     void stop() noexcept {
-      long expected = 0;
-      while(!count.compare_exchange_weak(expected, -1)) {
-        if(expected < 0)
+      stopped = true;
+      for(auto &stripe : stripes) {
+        while(stripe.count != 0)
+          spin_loop_pause();
+      }
+    }
+
+    /// Returns the number of shared locks, or -1 if stopped and all shared locks are released
+    long count() const noexcept {
+      long result = 0;
+      for(auto &stripe : stripes)
+        result += stripe.count;
+      return stopped && result == 0 ? -1 : result;
+    }
+  };
+
+  /// Memory blocks that are reused for the Asio operations of a connection, instead of allocating memory for each operation.
+  /// Operations larger than a block, or that find all blocks in use, fall back to operator new.
+  class HandlerMemory {
+    static const std::size_t block_size = 512;
+    /// For instance a read, a write and a timer operation at the same time
+    static const std::size_t block_count = 3;
+
+    typename std::aligned_storage<block_size>::type blocks[block_count];
+    std::atomic<bool> blocks_in_use[block_count];
+
+  public:
+    HandlerMemory() noexcept {
+      for(auto &in_use : blocks_in_use)
+        in_use = false;
+    }
+    HandlerMemory(const HandlerMemory &) = delete;
+    HandlerMemory &operator=(const HandlerMemory &) = delete;
+
+    void *allocate(std::size_t size) {
+      if(size <= block_size) {
+        for(std::size_t c = 0; c < block_count; ++c) {
+          bool expected = false;
+          if(!blocks_in_use[c].load(std::memory_order_relaxed) && blocks_in_use[c].compare_exchange_strong(expected, true, std::memory_order_acquire))
+            return &blocks[c];
+        }
+      }
+      return ::operator new(size);
+    }
+
+    void deallocate(void *pointer) noexcept {
+      for(std::size_t c = 0; c < block_count; ++c) {
+        if(pointer == &blocks[c]) {
+          blocks_in_use[c].store(false, std::memory_order_release);
+          return;
+        }
+      }
+      ::operator delete(pointer);
+    }
+  };
+
+  /// Allocator that Asio uses for the operations of a MemoryHandler.
+  template <class T>
+  class HandlerAllocator {
+  public:
+    using value_type = T;
+
+    HandlerMemory *memory;
+
+    explicit HandlerAllocator(HandlerMemory &memory) noexcept : memory(&memory) {}
+    template <class U>
+    HandlerAllocator(const HandlerAllocator<U> &other) noexcept : memory(other.memory) {}
+
+    T *allocate(std::size_t n) {
+      return static_cast<T *>(memory->allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T *pointer, std::size_t /*n*/) noexcept {
+      memory->deallocate(pointer);
+    }
+
+    template <class U>
+    bool operator==(const HandlerAllocator<U> &other) const noexcept {
+      return memory == other.memory;
+    }
+    template <class U>
+    bool operator!=(const HandlerAllocator<U> &other) const noexcept {
+      return memory != other.memory;
+    }
+  };
+
+  /// Completion handler whose operations are allocated from the handler_memory member of the given owner, through either
+  /// the associated allocator (Asio 1.11.0 or Boost 1.66 and newer) or the asio_handler_allocate hooks.
+  /// The owner is kept alive until the operation memory has been released.
+  template <class Handler>
+  class MemoryHandler {
+    std::shared_ptr<void> owner;
+    HandlerMemory *memory;
+    Handler handler;
+
+  public:
+    using allocator_type = HandlerAllocator<void>;
+
+    MemoryHandler(std::shared_ptr<void> owner, HandlerMemory &memory, Handler handler) : owner(std::move(owner)), memory(&memory), handler(std::move(handler)) {}
+
+    allocator_type get_allocator() const noexcept {
+      return allocator_type(*memory);
+    }
+
+    template <class... Args>
+    void operator()(Args &&... args) {
+      handler(std::forward<Args>(args)...);
+    }
+
+    friend void *asio_handler_allocate(std::size_t size, MemoryHandler *memory_handler) {
+      return memory_handler->memory->allocate(size);
+    }
+
+    friend void asio_handler_deallocate(void *pointer, std::size_t /*size*/, MemoryHandler *memory_handler) {
+      memory_handler->memory->deallocate(pointer);
+    }
+  };
+
+  template <class Owner, class Handler>
+  MemoryHandler<typename std::decay<Handler>::type> make_memory_handler(const std::shared_ptr<Owner> &owner, Handler &&handler) {
+    return MemoryHandler<typename std::decay<Handler>::type>(owner, owner->handler_memory, std::forward<Handler>(handler));
+  }
+
+  /// Memory that is handed out in sequence from a buffer, and that is reset rather than freed when all of its allocations
+  /// have been released. Used for the objects that are created for each request on a connection.
+  /// Since the objects of a request are still alive when the next request on the connection is started, the buffer is
+  /// split in two halves that are used by every other request, see next().
+  /// Allocations that do not fit in the rest of the current half fall back to operator new.
+  class Arena {
+    /// Allocations are made from the io thread running the connection, but the request and response are shared
+    /// with the user, and can be released from any thread, for instance when a response is sent from a worker thread.
+    std::mutex mutex;
+    std::size_t half_capacity;
+    std::unique_ptr<char[]> buffer;
+    std::size_t used[2] = {0, 0};
+    std::size_t allocations[2] = {0, 0};
+    std::size_t current = 0;
+
+  public:
+    /// The buffer of the given capacity is allocated on first use.
+    /// Each half of the buffer is rounded down to alignof(std::max_align_t), so that both halves start aligned.
+    explicit Arena(std::size_t capacity) noexcept : half_capacity((capacity / 2) & ~(alignof(std::max_align_t) - 1)) {}
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    /// Continue allocating from the other half of the buffer if all of its allocations have been released.
+    void next() noexcept {
+      std::unique_lock<std::mutex> lock(mutex);
+      if(allocations[1 - current] == 0)
+        current = 1 - current;
+    }
+
+    void *allocate(std::size_t size, std::size_t alignment) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto offset = (used[current] + alignment - 1) & ~(alignment - 1);
+        if(offset + size <= half_capacity) {
+          if(!buffer)
+            buffer = std::unique_ptr<char[]>(new char[half_capacity * 2]);
+          used[current] = offset + size;
+          ++allocations[current];
+          return buffer.get() + current * half_capacity + offset;
+        }
+      }
+      return ::operator new(size);
+    }
+
+    void deallocate(void *pointer) noexcept {
+      auto data = static_cast<char *>(pointer);
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if(buffer && data >= buffer.get() && data < buffer.get() + half_capacity * 2) {
+          auto half = data < buffer.get() + half_capacity ? 0 : 1;
+          if(--allocations[half] == 0)
+            used[half] = 0;
           return;
-        expected = 0;
-        spin_loop_pause();
+        }
       }
+      ::operator delete(pointer);
+    }
+  };
+
+  /// Allocator that allocates from an Arena, and keeps the Arena alive. Without an Arena, operator new is used.
+  template <class T>
+  class ArenaAllocator {
+  public:
+    using value_type = T;
+
+    std::shared_ptr<Arena> arena;
+
+    explicit ArenaAllocator(std::shared_ptr<Arena> arena = nullptr) noexcept : arena(std::move(arena)) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U> &other) noexcept : arena(other.arena) {}
+
+    T *allocate(std::size_t n) {
+      if(arena)
+        return static_cast<T *>(arena->allocate(sizeof(T) * n, alignof(T)));
+      return static_cast<T *>(::operator new(sizeof(T) * n));
+    }
+
+    void deallocate(T *pointer, std::size_t /*n*/) noexcept {
+      if(arena)
+        arena->deallocate(pointer);
+      else
+        ::operator delete(pointer);
+    }
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U> &other) const noexcept {
+      return arena == other.arena;
+    }
+    template <class U>
+    bool operator!=(const ArenaAllocator<U> &other) const noexcept {
+      return arena != other.arena;
+    }
+  };
+
+  /// Deleter of an object that was constructed in memory from Arena::allocate().
+  template <class T>
+  class ArenaDeleter {
+  public:
+    std::shared_ptr<Arena> arena;
+
+    explicit ArenaDeleter(std::shared_ptr<Arena> arena) noexcept : arena(std::move(arena)) {}
+
+    void operator()(T *pointer) noexcept {
+      pointer->~T();
+      arena->deallocate(pointer);
     }
   };
 } // namespace SimpleWeb